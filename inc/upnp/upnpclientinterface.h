@@ -17,7 +17,10 @@
 #ifndef UPNP_CLIENT_INTERFACE_H
 #define UPNP_CLIENT_INTERFACE_H
 
+#include <set>
+#include <chrono>
 #include <string>
+#include <functional>
 
 #include "utils/signal.h"
 
@@ -31,6 +34,8 @@ struct Upnp_Event;
 namespace upnp
 {
 
+class HttpConnectionPool;
+
 struct DeviceDiscoverInfo
 {
     uint32_t        expirationTime;
@@ -49,6 +54,19 @@ public:
     virtual std::string getSubscriptionId() = 0;
 };
 
+struct EventQueueSettings
+{
+    // number of threads that dispatch the events, with 0 threads the events are
+    // dispatched synchronously on the threads of the UPnP stack
+    uint32_t    threadCount = 0;
+    // maximum number of pending events, new events are dropped when the queue is full
+    uint32_t    capacity = 1024;
+};
+
+// called with UPNP_E_SUCCESS and the response document when the action succeeded,
+// called with the error code (and an empty document) otherwise
+using ActionResultCb = std::function<void(int32_t errorCode, xml::Document result)>;
+
 class IClient
 {
 public:
@@ -58,6 +76,15 @@ public:
     virtual void destroy() = 0;
     virtual void reset() = 0;
 
+    // maximum size of the SOAP messages that are processed, large browse responses
+    // can exceed the default of 1MB. Can be changed at runtime.
+    virtual void setMaxContentLength(size_t bytes) = 0;
+
+    // the settings are applied on the next initialize
+    virtual void setEventQueueSettings(const EventQueueSettings& settings) = 0;
+    // the number of events that were dropped because the event queue was full
+    virtual uint64_t getDroppedEventCount() const = 0;
+
     virtual std::string getIpAddress() const = 0;
     virtual int32_t getPort() const = 0;
     virtual void searchDevicesOfType(DeviceType type, int32_t timeout) const = 0;
@@ -74,8 +101,24 @@ public:
     virtual void unsubscribeFromService(const std::shared_ptr<IServiceSubscriber>& sub) const = 0;
 
     virtual xml::Document sendAction(const Action& action) const = 0;
+    // asynchronously executes the action, returns as soon as the request is queued so
+    // multiple actions can be in flight. The callback is called from a UPnP thread.
+    // The action is taken by value so callers can move it into the request.
+    virtual void sendActionAsync(Action action, const ActionResultCb& cb) const = 0;
+    // when set the synchronous actions are sent over the keep-alive connections of the pool
+    virtual void setConnectionPool(const std::shared_ptr<HttpConnectionPool>& pool) = 0;
+    // identical concurrent actions (same url and arguments) named in actionNames share one request,
+    // only side effect free actions (e.g. GetVolume) should be listed. An empty set disables it.
+    // The result of a request is reused for identical requests during the result time to live.
+    virtual void setActionCoalescing(const std::set<std::string>& actionNames, std::chrono::milliseconds resultTimeToLive) = 0;
     virtual xml::Document downloadXmlDocument(const std::string& url) const = 0;
 
+    // caches the documents returned by downloadXmlDocument (device and service descriptions)
+    // keyed on their url. A time to live of 0 disables the cache, the least recently used
+    // documents are evicted when the total size exceeds maxSizeInBytes.
+    virtual void setDocumentCache(std::chrono::seconds timeToLive, uint64_t maxSizeInBytes) = 0;
+    virtual void clearDocumentCache() = 0;
+
     utils::Signal<const DeviceDiscoverInfo&> UPnPDeviceDiscoveredEvent;
     utils::Signal<const std::string&> UPnPDeviceDissapearedEvent;
     utils::Signal<Upnp_Event*> UPnPEventOccurredEvent;
@@ -45,7 +45,7 @@ public:
 
     Client(IClient& client);
 
-    void setDevice(const std::shared_ptr<Device>& device) override;
+    void setDevice(const std::shared_ptr<const Device>& device) override;
 
     void abort();
 
@@ -75,7 +75,8 @@ private:
 
     static void addPropertyToList(const std::string& propertyName, std::vector<Property>& vec);
 
-    xml::Document parseBrowseResult(xml::Document& doc, ActionResult& result);
+    // the response document is released once the result is extracted to limit the memory use
+    xml::Document parseBrowseResult(xml::Document doc, ActionResult& result);
     Item parseMetaData(xml::Document& doc);
     Item parseContainer(xml::Element& containerElem);
 
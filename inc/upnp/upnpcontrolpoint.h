@@ -17,6 +17,7 @@
 #ifndef UPNP_CONTROL_POINT_H
 #define UPNP_CONTROL_POINT_H
 
+#include <deque>
 #include <string>
 #include <mutex>
 
@@ -44,7 +45,7 @@ public:
     ControlPoint& operator=(const ControlPoint&) = delete;
 
     void setWebserver(WebServer& webServer);
-    void setRendererDevice(const std::shared_ptr<Device>& dev);
+    void setRendererDevice(const std::shared_ptr<const Device>& dev);
     MediaRenderer& getActiveRenderer();
 
     void activate();
@@ -68,11 +69,15 @@ private:
 
     void throwOnMissingWebserver();
     void stopPlaybackIfNecessary();
+    // removes the oldest playlists until only keepPrevious playlists remain besides the new one
+    void addPlaylistFile(const std::string& filename, const std::string& playlist, size_t keepPrevious);
     std::string generatePlaylistFilename();
     Item createPlaylistItem(const std::string& filename);
 
-    MediaRenderer m_renderer;
-    WebServer*    m_pWebServer;
+    MediaRenderer           m_renderer;
+    WebServer*              m_pWebServer;
+    // the hosted playlists, oldest first
+    std::deque<std::string> m_playlists;
 };
 
 }
@@ -62,6 +62,8 @@ public:
     std::string     m_containerId;
 
     std::chrono::system_clock::time_point   m_timeoutTime;
+    // false for devices loaded from the cache that were not revalidated yet
+    bool                                    m_verified = true;
 
     std::map<ServiceType, Service>    m_services;
 
@@ -24,6 +24,9 @@
 #include <memory>
 #include <future>
 #include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <condition_variable>
 
 #include "upnp/upnpdevice.h"
 #include "upnp/upnpclientinterface.h"
@@ -35,6 +38,16 @@
 namespace upnp
 {
 
+// Immutable list of the scanned devices, a snapshot with a higher version
+// is published every time a device is added, removed or updated. Advertisements
+// that only renew a verified device are not published, the timeout time of a
+// published device is the one at the time it was published.
+struct DeviceSnapshot
+{
+    uint64_t                                                version = 0;
+    std::map<std::string, std::shared_ptr<const Device>>    devices;
+};
+
 class DeviceScanner
 {
 public:
@@ -42,38 +55,61 @@ public:
     DeviceScanner(IClient& client, std::set<DeviceType> types);
     ~DeviceScanner() throw();
 
+    // Opt-in cache of the discovered devices: loaded on start and saved on stop. The cached
+    // devices are reported immediately as unverified and revalidated in the background.
+    void setCacheFile(const std::string& path);
+
     void start();
     void stop();
     void refresh();
 
     uint32_t getDeviceCount() const;
-    std::shared_ptr<Device> getDevice(const std::string& udn) const;
-    std::map<std::string, std::shared_ptr<Device>> getDevices() const;
+    // the devices are never modified, an update of a device replaces the instance
+    std::shared_ptr<const Device> getDevice(const std::string& udn) const;
+    std::map<std::string, std::shared_ptr<const Device>> getDevices() const;
+    // does not lock or copy, compare the versions to detect changes
+    std::shared_ptr<const DeviceSnapshot> getDeviceSnapshot() const;
 
-    utils::Signal<std::shared_ptr<Device>> DeviceDiscoveredEvent;
-    utils::Signal<std::shared_ptr<Device>> DeviceDissapearedEvent;
+    utils::Signal<std::shared_ptr<const Device>> DeviceDiscoveredEvent;
+    utils::Signal<std::shared_ptr<const Device>> DeviceDissapearedEvent;
 
 private:
     void onDeviceDiscovered(const DeviceDiscoverInfo& info);
     void onDeviceDissapeared(const std::string& deviceId);
-    void updateDevice(const DeviceDiscoverInfo& info, const std::shared_ptr<Device>& device);
+    void updateDevice(const DeviceDiscoverInfo& info);
     void obtainDeviceDetails(const DeviceDiscoverInfo& info, const std::shared_ptr<Device>& device);
-    static xml::NodeList getFirstServiceList(xml::Document& doc);
-    static bool findAndParseService(xml::Document& doc, ServiceType serviceType, const std::shared_ptr<Device>& device);
 
     void checkForTimeoutThread();
+    void loadCache(const std::string& path);
+    void saveCache(const std::string& path) const;
+    void revalidateDevice(const std::shared_ptr<const Device>& device);
+    // the expiry queue holds the current deadline of every device, protected by the data mutex
+    void scheduleExpiry(const std::string& udn, std::chrono::system_clock::time_point deadline);
+    std::chrono::system_clock::time_point getExpiry(const std::string& udn) const;
+    void cancelExpiry(const std::string& udn);
+    // publishes a new snapshot of the devices, called under the data mutex
+    void publishDevices();
+
+    using ExpiryQueue = std::multimap<std::chrono::system_clock::time_point, std::string>;
+    using ExpiryEntries = std::unordered_map<std::string, ExpiryQueue::iterator>;
+
+    IClient&                                                m_client;
+    const std::set<DeviceType>                              m_types;
+    std::map<std::string, std::shared_ptr<const Device>>    m_devices;
+    ExpiryQueue                                             m_expiryQueue;
+    ExpiryEntries                                           m_expiryEntries;
+    // device id and location of the descriptions that are being downloaded
+    std::set<std::pair<std::string, std::string>>           m_pendingDownloads;
+    mutable std::mutex                                      m_mutex;
+    mutable std::mutex                                      m_dataMutex;
 
-    IClient&                                        m_client;
-    const std::set<DeviceType>                      m_types;
-    std::map<std::string, std::shared_ptr<Device>>  m_devices;
-    mutable std::mutex                              m_mutex;
-    mutable std::mutex                              m_dataMutex;
-
-    std::future<void>                               m_thread;
-    utils::ThreadPool                               m_downloadPool;
-    std::condition_variable                         m_condition;
-    bool                                            m_started;
-    bool                                            m_stop;
+    std::future<void>                                       m_thread;
+    utils::ThreadPool                                       m_downloadPool;
+    std::condition_variable                                 m_condition;
+    bool                                                    m_started;
+    bool                                                    m_stop;
+    std::string                                             m_cacheFile;
+    std::shared_ptr<const DeviceSnapshot>                   m_snapshot;
 
 };
 
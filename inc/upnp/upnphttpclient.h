@@ -19,8 +19,11 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <cinttypes>
 
+#include "upnp/upnphttpconnectionpool.h"
+
 namespace upnp
 {
 
@@ -28,6 +31,8 @@ class HttpClient
 {
 public:
 	HttpClient(int32_t commandTimeout);
+    // the requests are sent over the keep-alive connections of the pool
+    HttpClient(int32_t commandTimeout, std::shared_ptr<HttpConnectionPool> pool);
     HttpClient(const HttpClient&) = delete;
 
     size_t getContentLength(const std::string& url);
@@ -44,8 +49,10 @@ private:
     void* open(const std::string& url, int32_t& contentLength, int32_t& httpStatus, uint64_t offset, uint64_t size);
     void read(void* pHandle, uint8_t* pData, size_t dataSize);
     void throwOnBadHttpStatus(const std::string& url, int32_t status);
+    HttpResponse pooledRequest(const std::string& method, const std::string& url, uint64_t offset = 0, uint64_t size = 0);
 
-	int32_t		m_timeout;
+    int32_t                                 m_timeout;
+    std::shared_ptr<HttpConnectionPool>     m_pool;
 };
 
 }
@@ -0,0 +1,92 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef UPNP_HTTP_CONNECTION_POOL_H
+#define UPNP_HTTP_CONNECTION_POOL_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cinttypes>
+#include <condition_variable>
+
+namespace upnp
+{
+
+struct HttpResponse
+{
+    int32_t                             status = 0;
+    // the header names are lower case
+    std::map<std::string, std::string>  headers;
+    std::string                         body;
+};
+
+// Keeps HTTP/1.1 connections alive between requests to the same host:port so
+// successive requests (e.g. SOAP actions to a renderer) don't pay for a new
+// connection every time. Idle connections are closed after the idle timeout (checked
+// whenever a connection is acquired or released), at most maxConnectionsPerHost
+// connections are open to a host at the same time.
+class HttpConnectionPool
+{
+public:
+    HttpConnectionPool(uint32_t maxConnectionsPerHost = 2, std::chrono::seconds idleTimeout = std::chrono::seconds(30));
+    HttpConnectionPool(const HttpConnectionPool&) = delete;
+    ~HttpConnectionPool();
+
+    HttpConnectionPool& operator=(const HttpConnectionPool&) = delete;
+
+    // responses with a body larger than maxContentLength are rejected
+    HttpResponse request(const std::string& method, const std::string& url,
+                         const std::vector<std::pair<std::string, std::string>>& headers,
+                         const std::string& body, std::chrono::milliseconds timeout,
+                         size_t maxContentLength = std::numeric_limits<size_t>::max());
+
+    void closeIdleConnections();
+
+private:
+    struct IdleConnection
+    {
+        int                                     socket;
+        std::chrono::steady_clock::time_point   idleSince;
+    };
+
+    struct Host
+    {
+        uint32_t                    activeConnections = 0;
+        // requests waiting for a connection, the host is kept while they reference it
+        uint32_t                    waitingRequests = 0;
+        std::vector<IdleConnection> idleConnections;
+    };
+
+    int acquireConnection(const std::string& host, const std::string& port, std::chrono::milliseconds timeout, bool& reused);
+    void releaseConnection(const std::string& hostKey, int socket, bool keepAlive);
+    void closeExpiredConnections(Host& host, std::chrono::steady_clock::time_point now);
+    // closes the expired connections of all hosts and forgets the hosts that are no longer used
+    void closeExpiredConnections(std::chrono::steady_clock::time_point now);
+
+    uint32_t                        m_maxConnectionsPerHost;
+    std::chrono::seconds            m_idleTimeout;
+    std::mutex                      m_mutex;
+    std::condition_variable         m_condition;
+    std::map<std::string, Host>     m_hosts;
+};
+
+}
+
+#endif
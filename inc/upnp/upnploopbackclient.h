@@ -0,0 +1,171 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#ifndef UPNP_LOOPBACK_CLIENT_H
+#define UPNP_LOOPBACK_CLIENT_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "upnp/upnpclientinterface.h"
+#include "upnp/upnprootdeviceinterface.h"
+
+namespace upnp
+{
+
+class EventQueue;
+class LoopbackRootDevice;
+
+// Client that connects the control points to root devices in the same process without
+// any sockets. Actions, subscriptions, events and description downloads are handled in
+// memory, the asynchronous requests and events are dispatched on the threads of the event
+// queue. An optional latency is added to every request to simulate the network.
+// The root devices must be destroyed before the client.
+class LoopbackClient : public IClient
+{
+public:
+    LoopbackClient();
+    LoopbackClient(const LoopbackClient&) = delete;
+    virtual ~LoopbackClient();
+
+    LoopbackClient& operator=(const LoopbackClient&) = delete;
+
+    // latency that is added to every request (actions, subscriptions, downloads and searches)
+    void setLatency(std::chrono::microseconds latency);
+
+    virtual void initialize(const char* interfaceName = nullptr, int32_t port = 0) override;
+    virtual void destroy() override;
+    virtual void reset() override;
+
+    // there is no transport, the settings below are ignored
+    virtual void setMaxContentLength(size_t bytes) override;
+    virtual void setConnectionPool(const std::shared_ptr<HttpConnectionPool>& pool) override;
+    virtual void setActionCoalescing(const std::set<std::string>& actionNames, std::chrono::milliseconds resultTimeToLive) override;
+    virtual void setDocumentCache(std::chrono::seconds timeToLive, uint64_t maxSizeInBytes) override;
+    virtual void clearDocumentCache() override;
+
+    virtual void setEventQueueSettings(const EventQueueSettings& settings) override;
+    virtual uint64_t getDroppedEventCount() const override;
+
+    virtual std::string getIpAddress() const override;
+    virtual int32_t getPort() const override;
+
+    virtual void searchDevicesOfType(DeviceType type, int32_t timeout) const override;
+    virtual void searchAllDevices(int32_t timeout) const override;
+
+    virtual std::string subscribeToService(const std::string& publisherUrl, int32_t& timeout) const override;
+    virtual void unsubscribeFromService(const std::string& subscriptionId) const override;
+
+    virtual void subscribeToService(const std::string& publisherUrl, int32_t timeout, const std::shared_ptr<IServiceSubscriber>& sub) const override;
+    virtual void unsubscribeFromService(const std::shared_ptr<IServiceSubscriber>& sub) const override;
+
+    virtual xml::Document sendAction(const Action& action) const override;
+    virtual void sendActionAsync(Action action, const ActionResultCb& cb) const override;
+    virtual xml::Document downloadXmlDocument(const std::string& url) const override;
+
+private:
+    friend class LoopbackRootDevice;
+
+    struct RegisteredDevice
+    {
+        LoopbackRootDevice*         device;
+        std::string                 deviceType;
+        std::string                 location;
+        uint32_t                    expirationTime;
+        std::vector<std::string>    documentUrls;
+    };
+
+    struct ServiceEndpoint
+    {
+        LoopbackRootDevice*         device;
+        std::string                 udn;
+        std::string                 serviceId;
+    };
+
+    struct Subscription
+    {
+        LoopbackRootDevice*                 device;
+        std::string                         serviceId;
+        std::weak_ptr<IServiceSubscriber>   subscriber;
+        bool                                hasSubscriber;
+        int32_t                             eventKey;
+    };
+
+    // called by the root devices
+    std::string registerDevice(LoopbackRootDevice& device, const std::string& descriptionXml, const std::map<std::string, std::string>& documents, int32_t advertiseInterval);
+    void unregisterDevice(LoopbackRootDevice& device);
+    void acceptSubscription(LoopbackRootDevice& device, const std::string& serviceId, const std::string& subscriptionId, const xml::Document& response);
+    void notifyEvent(LoopbackRootDevice& device, const std::string& serviceId, const xml::Document& event);
+
+    void simulateLatency() const;
+    bool dispatch(const std::string& orderingKey, std::function<void()> event) const;
+    void announceDevices(const std::function<bool(const RegisteredDevice&)>& predicate) const;
+    ServiceEndpoint findEndpoint(const std::map<std::string, ServiceEndpoint>& endpoints, const std::string& url) const;
+    void addSubscription(const std::string& subscriptionId, const std::string& publisherUrl, const std::shared_ptr<IServiceSubscriber>& sub) const;
+    std::function<void()> createEventDispatcher(const std::string& subscriptionId, Subscription& subscription, const std::shared_ptr<const std::string>& event);
+
+    mutable std::mutex                                  m_mutex;
+    std::unique_ptr<EventQueue>                         m_eventQueue;
+    EventQueueSettings                                  m_eventQueueSettings;
+    std::atomic<std::chrono::microseconds::rep>         m_latency;
+    mutable uint32_t                                    m_subscriptionCount;
+    uint32_t                                            m_deviceCount;
+
+    std::map<std::string, RegisteredDevice>             m_devices;
+    std::map<std::string, ServiceEndpoint>              m_controlUrls;
+    std::map<std::string, ServiceEndpoint>              m_eventUrls;
+    std::map<std::string, std::string>                  m_documents;
+    mutable std::map<std::string, Subscription>         m_subscriptions;
+};
+
+// Root device that is only reachable through a loopback client, the device services
+// are used unmodified. The actions and subscription requests are delivered through the
+// ControlActionRequested and EventSubscriptionRequested signals like on the real root device.
+class LoopbackRootDevice : public IRootDevice
+{
+public:
+    LoopbackRootDevice(LoopbackClient& client, const std::string& udn, const std::string& descriptionXml, int32_t advertiseIntervalInSeconds);
+    virtual ~LoopbackRootDevice();
+
+    // serves an additional document (e.g. a service description) on the url relative
+    // to the device location, must be called before initialize
+    void addDocument(const std::string& relativeUrl, const std::string& xml);
+    // the location of the device description, available after initialize
+    std::string getLocation() const;
+
+    virtual void initialize() override;
+    virtual void destroy() override;
+
+    virtual std::string getUniqueDeviceName() override;
+    virtual void acceptSubscription(const std::string& serviceId, const std::string& subscriptionId, const xml::Document& response) override;
+    virtual void notifyEvent(const std::string& serviceId, const xml::Document& event) override;
+
+private:
+    LoopbackClient&                     m_client;
+    std::string                         m_udn;
+    std::string                         m_descriptionXml;
+    int32_t                             m_advertiseInterval;
+    std::map<std::string, std::string>  m_documents;
+    std::string                         m_location;
+};
+
+}
+
+#endif
@@ -70,8 +70,8 @@ public:
     MediaRenderer(IClient& cp);
     MediaRenderer(const MediaRenderer&) = delete;
 
-    std::shared_ptr<Device> getDevice();
-    void setDevice(const std::shared_ptr<Device>& device);
+    std::shared_ptr<const Device> getDevice();
+    void setDevice(const std::shared_ptr<const Device>& device);
     bool supportsPlayback(const upnp::Item& item, Resource& suggestedResource) const;
 
     // Connection management
@@ -109,12 +109,12 @@ public:
     void activateEvents();
     void deactivateEvents();
 
-    utils::Signal<std::shared_ptr<Device>>    DeviceChanged;
-    utils::Signal<uint32_t>                   VolumeChanged;
-    utils::Signal<const Item&>                CurrentTrackChanged;
-    utils::Signal<uint32_t>                   CurrentTrackDurationChanged;
-    utils::Signal<std::set<Action>>           AvailableActionsChanged;
-    utils::Signal<PlaybackState>              PlaybackStateChanged;
+    utils::Signal<std::shared_ptr<const Device>>    DeviceChanged;
+    utils::Signal<uint32_t>                         VolumeChanged;
+    utils::Signal<const Item&>                      CurrentTrackChanged;
+    utils::Signal<uint32_t>                         CurrentTrackDurationChanged;
+    utils::Signal<std::set<Action>>                 AvailableActionsChanged;
+    utils::Signal<PlaybackState>                    PlaybackStateChanged;
 
 private:
     void throwOnUnknownConnectionId() const;
@@ -132,7 +132,7 @@ private:
     static Action transportActionToAction(AVTransport::Action action);
     static PlaybackState transportStateToPlaybackState(AVTransport::State state);
 
-    std::shared_ptr<Device>                         m_device;
+    std::shared_ptr<const Device>                   m_device;
     IClient&                                        m_client;
     ConnectionManager::Client                       m_connectionMgr;
     RenderingControl::Client                        m_renderingControl;
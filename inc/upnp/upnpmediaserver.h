@@ -50,8 +50,8 @@ public:
     MediaServer(IClient& client);
     ~MediaServer();
 
-    void setDevice(const std::shared_ptr<Device>& device);
-    std::shared_ptr<Device> getDevice();
+    void setDevice(const std::shared_ptr<const Device>& device);
+    std::shared_ptr<const Device> getDevice();
 
     void abort();
 
@@ -106,7 +106,7 @@ private:
     void searchThread(const std::string& id, const ItemCb& onItem, const T& criteria);
     void getMetaDataThread(const std::string& objectId, const ItemCb& onItem);
 
-    std::shared_ptr<Device>                 m_device;
+    std::shared_ptr<const Device>           m_device;
 
     IClient&                                m_client;
     ContentDirectory::Client                m_contentDirectory;
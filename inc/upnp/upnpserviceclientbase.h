@@ -60,11 +60,11 @@ public:
         }
     }
 
-    virtual void setDevice(const std::shared_ptr<Device>& device)
+    virtual void setDevice(const std::shared_ptr<const Device>& device)
     {
         if (device->implementsService(getType()))
         {
-            m_service = device->m_services[getType()];
+            m_service = device->m_services.at(getType());
             parseServiceDescription(m_service.m_scpdUrl);
         }
     }
@@ -75,8 +75,8 @@ public:
         catch (std::exception& e) { utils::log::warn(e.what()); }
 
         std::lock_guard<std::mutex> lock(m_eventMutex);
+        // the client routes the events of the subscription directly to the subscriber
         m_subscriber = std::make_shared<ServiceSubscriber>(std::bind(&ServiceClientBase::eventCb, this, std::placeholders::_1, std::placeholders::_2));
-        m_client.UPnPEventOccurredEvent.connect([this] (Upnp_Event* arg) { eventOccurred(arg); }, this);
         m_client.subscribeToService(m_service.m_eventSubscriptionURL, getSubscriptionTimeout(), m_subscriber);
     }
 
@@ -87,7 +87,6 @@ public:
         {
             auto subCopy = m_subscriber;
             m_subscriber.reset();
-            m_client.UPnPEventOccurredEvent.disconnect(this);
             m_client.unsubscribeFromService(subCopy);
         }
     }
@@ -129,53 +128,50 @@ protected:
         }
     }
 
+    // only receives the events of its own subscription, the client routes them on subscription id
     void eventOccurred(Upnp_Event* pEvent)
     {
-        std::string sid = pEvent->Sid;
-        if (sid == m_subscriber->getSubscriptionId())
+        try
         {
-            try
+            xml::Document doc(pEvent->ChangedVariables, xml::Document::NoOwnership);
+            xml::Element propertySet = doc.getFirstChild();
+            for (xml::Element property : propertySet.getChildNodes())
             {
-                xml::Document doc(pEvent->ChangedVariables, xml::Document::NoOwnership);
-                xml::Element propertySet = doc.getFirstChild();
-                for (xml::Element property : propertySet.getChildNodes())
+                for (xml::Element var : property.getChildNodes())
                 {
-                    for (xml::Element var : property.getChildNodes())
+                    try
                     {
-                        try
-                        {
-                            VariableType changedVar = variableFromString(var.getName());
-
-                            xml::Document changeDoc(var.getValue());
-                            xml::Element eventNode = changeDoc.getFirstChild();
-                            xml::Element instanceIDNode = eventNode.getChildElement("InstanceID");
-
-                            std::map<VariableType, std::string> vars;
-                            for (xml::Element elem : instanceIDNode.getChildNodes())
-                            {
-                                auto str = elem.getAttribute("val");
-                                utils::log::debug("{} {}", elem.getName(), elem.getAttribute("val"));
-                                vars.insert(std::make_pair(variableFromString(elem.getName()), elem.getAttribute("val")));
-                            }
+                        VariableType changedVar = variableFromString(var.getName());
 
-                            // let the service implementation process the event if necessary
-                            handleStateVariableEvent(changedVar, vars);
+                        xml::Document changeDoc(var.getValue());
+                        xml::Element eventNode = changeDoc.getFirstChild();
+                        xml::Element instanceIDNode = eventNode.getChildElement("InstanceID");
 
-                            // notify clients
-                            StateVariableEvent(changedVar, vars);
-                        }
-                        catch (std::exception& e)
+                        std::map<VariableType, std::string> vars;
+                        for (xml::Element elem : instanceIDNode.getChildNodes())
                         {
-                            utils::log::warn("Unknown event variable ignored: {}", e.what());
-                            utils::log::debug(var.toString());
+                            auto str = elem.getAttribute("val");
+                            utils::log::debug("{} {}", elem.getName(), elem.getAttribute("val"));
+                            vars.insert(std::make_pair(variableFromString(elem.getName()), elem.getAttribute("val")));
                         }
+
+                        // let the service implementation process the event if necessary
+                        handleStateVariableEvent(changedVar, vars);
+
+                        // notify clients
+                        StateVariableEvent(changedVar, vars);
+                    }
+                    catch (std::exception& e)
+                    {
+                        utils::log::warn("Unknown event variable ignored: {}", e.what());
+                        utils::log::debug(var.toString());
                     }
                 }
             }
-            catch (std::exception& e)
-            {
-                utils::log::error("Failed to parse event: {}", e.what());
-            }
+        }
+        catch (std::exception& e)
+        {
+            utils::log::error("Failed to parse event: {}", e.what());
         }
     }
 
@@ -206,6 +202,18 @@ protected:
         return xml::Document();
     }
 
+    // the callback receives the UPnP error code, service specific error codes are not translated
+    void executeActionAsync(ActionType actionType, const std::map<std::string, std::string>& args, const ActionResultCb& cb)
+    {
+        Action action(actionToString(actionType), m_service.m_controlURL, getType());
+        for (auto& arg : args)
+        {
+            action.addArgument(arg.first, arg.second);
+        }
+
+        m_client.sendActionAsync(std::move(action), cb);
+    }
+
     virtual ServiceType getType() = 0;
     virtual int32_t getSubscriptionTimeout() = 0;
     virtual void handleStateVariableEvent(VariableType /*changedVariable*/, const std::map<VariableType, std::string>& /*variables*/) {}
@@ -216,6 +224,13 @@ protected:
 private:
     void eventCb(Upnp_EventType eventType, void* pEvent)
     {
+        if (eventType == UPNP_EVENT_RECEIVED)
+        {
+            // not processed under the event mutex, event handlers are allowed to unsubscribe
+            eventOccurred(reinterpret_cast<Upnp_Event*>(pEvent));
+            return;
+        }
+
         std::lock_guard<std::mutex> lock(m_eventMutex);
         switch (eventType)
         {
@@ -226,8 +241,9 @@ private:
                 {
                     utils::log::error("Error in Event Subscribe Callback: {} ({})", UpnpGetErrorMessage(pSubEvent->ErrCode), pSubEvent->ErrCode);
                 }
-                else
+                else if (m_subscriber)
                 {
+                    // the subscriber is gone when unsubscribed before the subscription completed
                     m_subscriber->setSubscriptionId(pSubEvent->Sid);
 
 #ifdef DEBUG_SERVICE_SUBSCRIPTIONS
@@ -240,14 +256,18 @@ private:
             case UPNP_EVENT_SUBSCRIPTION_EXPIRED:
             {
                 auto pSubEvent = reinterpret_cast<Upnp_Event_Subscribe*>(pEvent);
+                if (!m_subscriber)
+                {
+                    break;
+                }
 
                 try
                 {
-                    int32_t timeout = getSubscriptionTimeout();
-                    m_subscriber->setSubscriptionId(m_client.subscribeToService(pSubEvent->PublisherUrl, timeout));
+                    // the new subscription id is set when the subscription completes
+                    m_client.subscribeToService(pSubEvent->PublisherUrl, getSubscriptionTimeout(), m_subscriber);
 
 #ifdef DEBUG_SERVICE_SUBSCRIPTIONS
-                    utils::log::debug("Service subscription renewed: {}", m_SubscriptionId);
+                    utils::log::debug("Service subscription renewal requested: {}", pSubEvent->PublisherUrl);
 #endif
                 }
                 catch (std::exception& e)
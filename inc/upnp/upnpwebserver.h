@@ -17,8 +17,11 @@
 #ifndef UPNP_WEBSERVER_H
 #define UPNP_WEBSERVER_H
 
+#include <chrono>
+#include <ctime>
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 
 #include "utils/fileoperations.h"
@@ -31,14 +34,52 @@ class IVirtualDirCallback
 public:
     virtual ~IVirtualDirCallback() = default;
 
+    // returns the number of bytes read, 0 indicates the end of the stream
+    // live sources should block until data is available
     virtual uint64_t read(uint8_t* buf, uint64_t buflen) = 0;
     virtual void seekAbsolute(uint64_t position) = 0;
     virtual void seekRelative(uint64_t offset) = 0;
     virtual void seekFromEnd(uint64_t offset) = 0;
     virtual void close() = 0;
+
+    // optional: position the stream on a time offset (DLNA time based seek), the end
+    // is zero when no end time was requested. Return false when time seeking is not supported.
+    virtual bool seekToTime(std::chrono::milliseconds /*start*/, std::chrono::milliseconds /*end*/) { return false; }
+};
+
+// a DLNA time seek range: npt=<start>-[<end>], the times are formatted as seconds
+// with an optional fraction or as h:mm:ss with an optional fraction
+struct TimeSeekRange
+{
+    std::chrono::milliseconds start { 0 };
+    std::chrono::milliseconds end { 0 };
+};
+
+// parses the value of a TimeSeekRange.dlna.org header, the npt= prefix is optional
+TimeSeekRange parseTimeSeekRange(const std::string& range);
+
+struct ReadAheadSettings
+{
+    // the size of the reads that are issued to the IVirtualDirCallback
+    uint32_t blockSize = 64 * 1024;
+    // the maximum amount of data that is buffered ahead of the current read position
+    uint32_t windowSize = 512 * 1024;
+};
+
+struct VirtualFileInfo
+{
+    uint64_t    sizeInBytes = 0;
+    // for live or transcoded streams of which the size is not known up front, the
+    // content is sent without a Content-Length until read returns 0, the end of
+    // the content is signaled to the client by closing the connection
+    bool        unknownSize = false;
+    time_t      modifyTime = 0;
+    bool        isDirectory = false;
+    std::string contentType = "application/octet-stream";
 };
 
 using FileInfoCb = std::function<utils::fileops::FileSystemEntryInfo(const std::string&)>;
+using VirtualFileInfoCb = std::function<VirtualFileInfo(const std::string&)>;
 using RequestCb = std::function<std::shared_ptr<IVirtualDirCallback>(const std::string&)>;
 
 class WebServer
@@ -49,16 +90,47 @@ public:
 
     void addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::string& data);
     void addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::vector<uint8_t>& data);
+    // the buffer is shared instead of copied, the same buffer can be hosted under multiple names
+    void addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::shared_ptr<const std::vector<uint8_t>>& data);
+    // hosts externally owned memory, use a custom deleter to get notified when the webserver no longer needs it
+    void addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::shared_ptr<const uint8_t>& data, uint64_t size);
     void removeFile(const std::string& virtualDir, const std::string& filename);
 
+    // limits the size of the in memory files, when a file is added the least recently
+    // requested files that are not pinned are evicted to stay within the budget (0 = unlimited)
+    void setMemoryBudget(uint64_t bytes);
+    // the file is no longer served when the time to live elapsed (0 = no expiry)
+    void setFileTimeToLive(const std::string& virtualDir, const std::string& filename, std::chrono::seconds timeToLive);
+    // pinned files are never evicted, they still expire when a time to live was set
+    void pinFile(const std::string& virtualDir, const std::string& filename, bool pinned = true);
+    // releases the memory of the expired files, this also happens on every addFile call
+    void purgeExpiredFiles();
+    // the size in bytes of the hosted in memory files, shared buffers are only counted once
+    uint64_t getMemoryUsage();
+
     void clearFiles();
 
     // adds a virtual directory, in memory files can be added using addFile
     void addVirtualDirectory(const std::string& virtualDirName);
     // adds a virtual directory, the callback is called on incoming requests in this directory
+    // requests can contain a time seek query parameter (file?npt=90.5-), the range is passed
+    // to seekToTime of the callback before the first read
     void addVirtualDirectory(const std::string& virtualDirName, FileInfoCb fileinfoCb, RequestCb requestCb);
+    // adds a virtual directory with callback, the data of the callbacks is read ahead on a background thread
+    void addVirtualDirectory(const std::string& virtualDirName, FileInfoCb fileinfoCb, RequestCb requestCb, const ReadAheadSettings& readAhead);
+    // same as above, the info callback also provides the content type of the files
+    void addVirtualDirectory(const std::string& virtualDirName, VirtualFileInfoCb fileinfoCb, RequestCb requestCb);
+    void addVirtualDirectory(const std::string& virtualDirName, VirtualFileInfoCb fileinfoCb, RequestCb requestCb, const ReadAheadSettings& readAhead);
+    // adds a virtual directory, requests in this directory are served from the files under rootPath
+    void addVirtualDirectory(const std::string& virtualDirName, const std::string& rootPath);
     void removeVirtualDirectory(const std::string& virtualDirName);
 
+    // when enabled the results of the file info callback of the directory are cached per
+    // request path until they are invalidated, avoids calling the callback on every (range) request
+    void setFileInfoCaching(const std::string& virtualDirName, bool enabled);
+    void invalidateFileInfo(const std::string& virtualDirName, const std::string& filename);
+    void invalidateFileInfo(const std::string& virtualDirName);
+
     std::string getWebRootUrl();
 
 private:
@@ -15,15 +15,22 @@
 //    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "upnpclient.h"
+#include "upnpeventqueue.h"
 
 #include <upnpconfig.h>
 
 #include "utils/log.h"
 #include "upnp/upnputils.h"
+#include "upnp/upnphttpconnectionpool.h"
 
+#include <list>
 #include <stdexcept>
 #include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <future>
+#include <unordered_map>
 #include <upnp.h>
 
 using namespace utils;
@@ -33,7 +40,98 @@ using namespace utils;
 namespace upnp
 {
 
-std::map<IServiceSubscriber*, std::weak_ptr<IServiceSubscriber>> Client::m_serviceSubscriptions;
+namespace
+{
+
+// queued copy of a received event, the changed variables are kept as xml text
+struct EventCopy
+{
+    Upnp_Event      event;
+    std::string     changedVariables;
+};
+
+// same timeout as the SOAP requests of libupnp
+const std::chrono::seconds g_soapTimeout(30);
+
+// the element name without namespace prefix
+std::string getLocalName(IXML_Node* pNode)
+{
+    std::string name = ixmlNode_getNodeName(pNode);
+    auto colonPos = name.find(':');
+    return colonPos == std::string::npos ? name : name.substr(colonPos + 1);
+}
+
+IXML_Node* findChildElement(IXML_Node* pParent, const std::string& localName)
+{
+    for (auto pNode = ixmlNode_getFirstChild(pParent); pNode != nullptr; pNode = ixmlNode_getNextSibling(pNode))
+    {
+        if (ixmlNode_getNodeType(pNode) == eELEMENT_NODE && (localName.empty() || localName == getLocalName(pNode)))
+        {
+            return pNode;
+        }
+    }
+
+    return nullptr;
+}
+
+std::string getChildElementValue(IXML_Node* pParent, const std::string& localName)
+{
+    auto pElement = findChildElement(pParent, localName);
+    auto pText = pElement ? ixmlNode_getFirstChild(pElement) : nullptr;
+    auto pValue = pText ? ixmlNode_getNodeValue(pText) : nullptr;
+    return pValue ? pValue : "";
+}
+
+// returns the action response element as document, like UpnpSendAction does
+xml::Document parseSoapResponse(const Action& action, HttpResponse response)
+{
+    xml::Document envelope(ixmlParseBuffer(response.body.c_str()));
+    // the body is no longer needed once it is parsed, release it before building the result
+    std::string().swap(response.body);
+
+    auto pEnvelope = envelope ? findChildElement(envelope, "") : nullptr;
+    auto pBody = pEnvelope ? findChildElement(pEnvelope, "Body") : nullptr;
+    auto pResponse = pBody ? findChildElement(pBody, "") : nullptr;
+    if (!pResponse)
+    {
+        throw Exception(UPNP_E_BAD_RESPONSE, "Invalid response for action {} (http status {})", action.getName(), response.status);
+    }
+
+    if (getLocalName(pResponse) == "Fault")
+    {
+        auto pDetail = findChildElement(pResponse, "detail");
+        auto pError = pDetail ? findChildElement(pDetail, "UPnPError") : nullptr;
+        if (!pError)
+        {
+            throw Exception(UPNP_E_BAD_RESPONSE, "Invalid fault response for action {}", action.getName());
+        }
+
+        auto errorCode = std::atoi(getChildElementValue(pError, "errorCode").c_str());
+        throw Exception(errorCode, "Action {} failed: {}", action.getName(), getChildElementValue(pError, "errorDescription"));
+    }
+
+    // the response element is moved out of the envelope and becomes the document element,
+    // the parsed tree is reused instead of printing and parsing the response again
+    IXML_Node* pDetached = nullptr;
+    if (ixmlNode_removeChild(pBody, pResponse, &pDetached) != IXML_SUCCESS)
+    {
+        throw Exception(UPNP_E_BAD_RESPONSE, "Invalid response for action {}", action.getName());
+    }
+
+    // frees the remainder of the envelope
+    ixmlNode_removeChild(envelope, pEnvelope, nullptr);
+    if (ixmlNode_appendChild(envelope, pDetached) != IXML_SUCCESS)
+    {
+        ixmlNode_free(pDetached);
+        throw Exception(UPNP_E_BAD_RESPONSE, "Invalid response for action {}", action.getName());
+    }
+
+    return envelope;
+}
+
+}
+
+std::shared_ptr<const Client::Subscriptions> Client::m_serviceSubscriptions = std::make_shared<Client::Subscriptions>();
 std::mutex Client::m_mutex;
 
 class Client::UpnpInitialization
@@ -76,7 +174,237 @@ private:
     UpnpClient_Handle   m_handle;
 };
 
-Client::Client() = default;
+// Caches the raw xml of downloaded documents, every hit is parsed into a new document
+// so the callers keep exclusive ownership of the documents they receive.
+// libupnp does not expose the http validators of the response, entries are only
+// revalidated by downloading them again when their time to live expired.
+class Client::DocumentCache
+{
+public:
+    void setSettings(std::chrono::seconds timeToLive, uint64_t maxSize)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_timeToLive = timeToLive;
+        m_maxSize = maxSize;
+        if (m_timeToLive.count() <= 0)
+        {
+            clearLocked();
+        }
+        else
+        {
+            evictLocked();
+        }
+    }
+
+    bool isEnabled()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_timeToLive.count() > 0;
+    }
+
+    bool get(const std::string& url, std::string& xml)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_entries.find(url);
+        if (iter == m_entries.end())
+        {
+            return false;
+        }
+
+        if (iter->second.expiryTime <= std::chrono::steady_clock::now())
+        {
+            removeLocked(iter);
+            return false;
+        }
+
+        m_lru.splice(m_lru.end(), m_lru, iter->second.lruPosition);
+        xml = iter->second.xml;
+        return true;
+    }
+
+    void put(const std::string& url, std::string xml)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_timeToLive.count() <= 0 || (m_maxSize > 0 && xml.size() > m_maxSize))
+        {
+            return;
+        }
+
+        auto iter = m_entries.find(url);
+        if (iter != m_entries.end())
+        {
+            removeLocked(iter);
+        }
+
+        Entry entry;
+        entry.expiryTime = std::chrono::steady_clock::now() + m_timeToLive;
+        entry.lruPosition = m_lru.insert(m_lru.end(), url);
+        m_size += xml.size();
+        entry.xml = std::move(xml);
+        m_entries.emplace(url, std::move(entry));
+
+        evictLocked();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        clearLocked();
+    }
+
+private:
+    struct Entry
+    {
+        std::string                             xml;
+        std::chrono::steady_clock::time_point   expiryTime;
+        std::list<std::string>::iterator        lruPosition;
+    };
+
+    void removeLocked(std::unordered_map<std::string, Entry>::iterator iter)
+    {
+        m_size -= iter->second.xml.size();
+        m_lru.erase(iter->second.lruPosition);
+        m_entries.erase(iter);
+    }
+
+    void evictLocked()
+    {
+        while (m_maxSize > 0 && m_size > m_maxSize && !m_lru.empty())
+        {
+            removeLocked(m_entries.find(m_lru.front()));
+        }
+    }
+
+    void clearLocked()
+    {
+        m_entries.clear();
+        m_lru.clear();
+        m_size = 0;
+    }
+
+    std::mutex                                  m_mutex;
+    std::chrono::seconds                        m_timeToLive { 0 };
+    uint64_t                                    m_maxSize = 0;
+    uint64_t                                    m_size = 0;
+    std::unordered_map<std::string, Entry>      m_entries;
+    // least recently used urls first
+    std::list<std::string>                      m_lru;
+};
+
+// Identical concurrent actions share a single request, the waiters all parse the
+// xml of the result (or receive the exception). The result of a completed request
+// is reused for subsequent identical requests during the result time to live.
+class Client::InFlightActions
+{
+public:
+    void setSettings(const std::set<std::string>& actionNames, std::chrono::milliseconds resultTimeToLive)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_actionNames = actionNames;
+        m_timeToLive = resultTimeToLive;
+        m_requests.clear();
+    }
+
+    bool isCoalesced(const std::string& actionName)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_actionNames.find(actionName) != m_actionNames.end();
+    }
+
+    template <typename Func>
+    xml::Document execute(const std::string& key, Func&& performRequest)
+    {
+        std::shared_ptr<Request> request;
+        bool owner = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto now = std::chrono::steady_clock::now();
+            auto iter = m_requests.find(key);
+            if (iter != m_requests.end() && (!iter->second->completed || now < iter->second->expiryTime))
+            {
+                request = iter->second;
+            }
+            else
+            {
+                removeExpired(now);
+                request = std::make_shared<Request>();
+                request->result = request->promise.get_future().share();
+                m_requests[key] = request;
+                owner = true;
+            }
+        }
+
+        if (!owner)
+        {
+            // rethrows the exception of the request
+            return xml::Document(request->result.get());
+        }
+
+        try
+        {
+            // the owner keeps the document, the others parse the serialized result
+            auto result = performRequest();
+            request->promise.set_value(result.toString());
+            complete(key, request, true);
+            return result;
+        }
+        catch (...)
+        {
+            request->promise.set_exception(std::current_exception());
+            complete(key, request, false);
+            throw;
+        }
+    }
+
+private:
+    struct Request
+    {
+        std::promise<std::string>                   promise;
+        std::shared_future<std::string>             result;
+        bool                                        completed = false;
+        std::chrono::steady_clock::time_point       expiryTime;
+    };
+
+    void complete(const std::string& key, const std::shared_ptr<Request>& request, bool succeeded)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        request->completed = true;
+        request->expiryTime = std::chrono::steady_clock::now() + m_timeToLive;
+
+        auto iter = m_requests.find(key);
+        if ((!succeeded || m_timeToLive.count() <= 0) && iter != m_requests.end() && iter->second == request)
+        {
+            m_requests.erase(iter);
+        }
+    }
+
+    void removeExpired(std::chrono::steady_clock::time_point now)
+    {
+        for (auto iter = m_requests.begin(); iter != m_requests.end();)
+        {
+            if (iter->second->completed && iter->second->expiryTime <= now)
+            {
+                iter = m_requests.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    std::mutex                                                  m_mutex;
+    std::set<std::string>                                       m_actionNames;
+    std::chrono::milliseconds                                   m_timeToLive { 0 };
+    std::unordered_map<std::string, std::shared_ptr<Request>>   m_requests;
+};
+
+Client::Client()
+: m_documentCache(std::make_unique<DocumentCache>())
+, m_inFlightActions(std::make_unique<InFlightActions>())
+, m_maxContentLength(1024 * 1024)
+{
+}
 
 Client::~Client()
 {
@@ -87,11 +415,16 @@ void Client::initialize(const char* interfaceName, int port)
 {
     log::debug("Initializing UPnP SDK");
 
+    if (m_eventQueueSettings.threadCount > 0)
+    {
+        m_eventQueue = std::make_unique<EventQueue>(m_eventQueueSettings.threadCount, m_eventQueueSettings.capacity);
+    }
+
     auto upnp   = std::make_unique<UpnpInitialization>(interfaceName, port);
     m_client    = std::make_unique<ClientHandle>(upnpCallback, this);
     m_upnp = std::move(upnp);
 
-    UpnpSetMaxContentLength(1024 * 1024);
+    UpnpSetMaxContentLength(m_maxContentLength);
 
     log::debug("Initialized: {}:{}", UpnpGetServerIpAddress(), UpnpGetServerPort());
 }
@@ -99,6 +432,8 @@ void Client::initialize(const char* interfaceName, int port)
 void Client::destroy()
 {
     m_client.reset();
+    // no more callbacks after the client is unregistered, pending events are dropped
+    m_eventQueue.reset();
     m_upnp.reset();
     log::debug("Destroyed UPnP SDK");
 }
@@ -109,6 +444,25 @@ void Client::reset()
     initialize();
 }
 
+void Client::setMaxContentLength(size_t bytes)
+{
+    m_maxContentLength = bytes;
+    if (m_upnp)
+    {
+        handleUPnPResult(UpnpSetMaxContentLength(bytes), "Failed to set the maximum content length");
+    }
+}
+
+void Client::setEventQueueSettings(const EventQueueSettings& settings)
+{
+    m_eventQueueSettings = settings;
+}
+
+uint64_t Client::getDroppedEventCount() const
+{
+    return m_eventQueue ? m_eventQueue->getDroppedCount() : 0;
+}
+
 std::string Client::getIpAddress() const
 {
     return UpnpGetServerIpAddress();
@@ -157,25 +511,103 @@ void Client::unsubscribeFromService(const std::string& subscriptionId) const
 
 void Client::subscribeToService(const std::string& publisherUrl, int32_t timeout, const std::shared_ptr<IServiceSubscriber>& sub) const
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
     log::debug("Subscribe to service: {}", publisherUrl);
-    handleUPnPResult(UpnpSubscribeAsync(*m_client, publisherUrl.c_str(), timeout, &Client::upnpServiceCallback, sub.get()), "Failed to subscribe to UPnP device service");
-    m_serviceSubscriptions.insert(std::make_pair(sub.get(), std::weak_ptr<IServiceSubscriber>(sub)));
+
+    // register the subscriber before subscribing, the completion callback can arrive before UpnpSubscribeAsync returns
+    updateSubscriptions([&] (Subscriptions& subscriptions) {
+        subscriptions.subscribers[sub.get()] = sub;
+    });
+
+    int rc = UpnpSubscribeAsync(*m_client, publisherUrl.c_str(), timeout, &Client::upnpServiceCallback, sub.get());
+    if (rc != UPNP_E_SUCCESS)
+    {
+        removeSubscriber(sub.get());
+        handleUPnPResult(rc, "Failed to subscribe to UPnP device service");
+    }
 }
 
 void Client::unsubscribeFromService(const std::shared_ptr<IServiceSubscriber>& sub) const
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    m_serviceSubscriptions.erase(sub.get());
+    removeSubscriber(sub.get());
+
+    // the network request is done without holding the lock
     unsubscribeFromService(sub->getSubscriptionId());
 }
 
+template <typename Func>
+void Client::updateSubscriptions(Func&& modify)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto subscriptions = std::make_shared<Subscriptions>(*m_serviceSubscriptions);
+    modify(*subscriptions);
+    std::atomic_store(&m_serviceSubscriptions, std::shared_ptr<const Subscriptions>(std::move(subscriptions)));
+}
+
+std::shared_ptr<IServiceSubscriber> Client::findSubscriber(const std::string& sid)
+{
+    auto subscriptions = std::atomic_load(&m_serviceSubscriptions);
+    auto iter = subscriptions->sids.find(sid);
+    if (iter != subscriptions->sids.end())
+    {
+        return iter->second.lock();
+    }
+
+    return nullptr;
+}
+
+void Client::removeSubscriber(IServiceSubscriber* sub)
+{
+    updateSubscriptions([sub] (Subscriptions& subscriptions) {
+        subscriptions.subscribers.erase(sub);
+        for (auto iter = subscriptions.sids.begin(); iter != subscriptions.sids.end();)
+        {
+            auto subscriber = iter->second.lock();
+            if (!subscriber || subscriber.get() == sub)
+            {
+                iter = subscriptions.sids.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    });
+}
+
 xml::Document Client::sendAction(const Action& action) const
+{
+    // only the actions that were explicitly listed are coalesced
+    if (m_inFlightActions->isCoalesced(action.getName()))
+    {
+        auto key = action.getUrl() + '\n' + action.getActionDocument().toString();
+        return m_inFlightActions->execute(key, [&] () { return performAction(action); });
+    }
+
+    return performAction(action);
+}
+
+xml::Document Client::performAction(const Action& action) const
 {
 #ifdef DEBUG_UPNP_CLIENT
     log::debug("Execute action: {}", action.getActionDocument().toString());
 #endif
 
+    // the pool can be replaced while actions are executed
+    auto pool = std::atomic_load(&m_connectionPool);
+    if (pool)
+    {
+        auto envelope = "<?xml version=\"1.0\"?>\r\n"
+                        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+                        "<s:Body>" + action.getActionDocument().getFirstChild().toString() + "</s:Body></s:Envelope>";
+
+        auto response = pool->request("POST", action.getUrl(), {
+            { "CONTENT-TYPE", "text/xml; charset=\"utf-8\"" },
+            { "SOAPACTION", fmt::format("\"{}#{}\"", action.getServiceTypeUrn(), action.getName()) }
+        }, envelope, g_soapTimeout, m_maxContentLength);
+
+        return parseSoapResponse(action, std::move(response));
+    }
+
     IXML_Document* pDoc = nullptr;
     handleUPnPResult(UpnpSendAction(*m_client, action.getUrl().c_str(), action.getServiceTypeUrn().c_str(), nullptr, action.getActionDocument(), &pDoc));
 
@@ -186,11 +618,67 @@ xml::Document Client::sendAction(const Action& action) const
     return xml::Document(pDoc);
 }
 
+void Client::setConnectionPool(const std::shared_ptr<HttpConnectionPool>& pool)
+{
+    std::atomic_store(&m_connectionPool, pool);
+}
+
+void Client::setActionCoalescing(const std::set<std::string>& actionNames, std::chrono::milliseconds resultTimeToLive)
+{
+    m_inFlightActions->setSettings(actionNames, resultTimeToLive);
+}
+
+void Client::sendActionAsync(Action action, const ActionResultCb& cb) const
+{
+#ifdef DEBUG_UPNP_CLIENT
+    log::debug("Execute async action: {}", action.getActionDocument().toString());
+#endif
+
+    // the action document is copied by libupnp, the callback is owned by the request until it completes
+    auto pCb = new ActionResultCb(cb);
+    int rc = UpnpSendActionAsync(*m_client, action.getUrl().c_str(), action.getServiceTypeUrn().c_str(), nullptr, action.getActionDocument(), &Client::upnpActionCallback, pCb);
+    if (rc != UPNP_E_SUCCESS)
+    {
+        delete pCb;
+        handleUPnPResult(rc, "Failed to send action: {}", action.getName());
+    }
+}
+
 xml::Document Client::downloadXmlDocument(const std::string& url) const
 {
-    IXML_Document* pDoc;
-    handleUPnPResult(UpnpDownloadXmlDoc(url.c_str(), &pDoc), "Error downloading xml document from {}", url);
-    return xml::Document(pDoc);
+    if (!m_documentCache->isEnabled())
+    {
+        IXML_Document* pDoc;
+        handleUPnPResult(UpnpDownloadXmlDoc(url.c_str(), &pDoc), "Error downloading xml document from {}", url);
+        return xml::Document(pDoc);
+    }
+
+    std::string xml;
+    if (!m_documentCache->get(url, xml))
+    {
+        char* pBuffer = nullptr;
+        char contentType[LINE_SIZE];
+        handleUPnPResult(UpnpDownloadUrlItem(url.c_str(), &pBuffer, contentType), "Error downloading xml document from {}", url);
+        xml = pBuffer;
+        free(pBuffer);
+
+        // parse before caching, invalid documents are not cached
+        xml::Document doc(xml);
+        m_documentCache->put(url, std::move(xml));
+        return doc;
+    }
+
+    return xml::Document(xml);
+}
+
+void Client::setDocumentCache(std::chrono::seconds timeToLive, uint64_t maxSizeInBytes)
+{
+    m_documentCache->setSettings(timeToLive, maxSizeInBytes);
+}
+
+void Client::clearDocumentCache()
+{
+    m_documentCache->clear();
 }
 
 int Client::upnpCallback(Upnp_EventType eventType, void* pEvent, void* pCookie)
@@ -217,7 +705,11 @@ int Client::upnpCallback(Upnp_EventType eventType, void* pEvent, void* pCookie)
             info.serviceType    = pDiscEvent->ServiceType;
             info.serviceVersion = pDiscEvent->ServiceVer;
 
-            pClient->UPnPDeviceDiscoveredEvent(info);
+            // repeated advertisements are not queued while an identical one is still pending
+            auto coalesceKey = fmt::format("{}|{}|{}|{}", info.deviceId, info.deviceType, info.serviceType, info.location);
+            pClient->dispatchEvent(info.deviceId, [pClient, info] () {
+                pClient->UPnPDeviceDiscoveredEvent(info);
+            }, coalesceKey);
         }
         break;
     }
@@ -230,13 +722,48 @@ int Client::upnpCallback(Upnp_EventType eventType, void* pEvent, void* pCookie)
         }
         else
         {
-            pClient->UPnPDeviceDissapearedEvent(pDiscEvent->DeviceId);
+            std::string deviceId = pDiscEvent->DeviceId;
+            pClient->dispatchEvent(deviceId, [pClient, deviceId] () {
+                pClient->UPnPDeviceDissapearedEvent(deviceId);
+            });
         }
         break;
     }
     case UPNP_EVENT_RECEIVED:
-        pClient->UPnPEventOccurredEvent(reinterpret_cast<Upnp_Event*>(pEvent));
+    {
+        auto pUpnpEvent = reinterpret_cast<Upnp_Event*>(pEvent);
+        if (!pClient->m_eventQueue)
+        {
+            pClient->onEventReceived(pUpnpEvent);
+            break;
+        }
+
+        // libupnp frees the event when the callback returns, the queued event needs its own copy
+        auto copy = std::make_shared<EventCopy>();
+        copy->event = *pUpnpEvent;
+        copy->event.ChangedVariables = nullptr;
+        copy->changedVariables = xml::Document(pUpnpEvent->ChangedVariables, xml::Document::NoOwnership).toString();
+
+        pClient->dispatchEvent(pUpnpEvent->Sid, [pClient, copy] () {
+            // parsed on the queue thread, the libupnp callback thread only serializes
+            xml::Document changedVariables(copy->changedVariables);
+            copy->event.ChangedVariables = changedVariables;
+            pClient->onEventReceived(&copy->event);
+            copy->event.ChangedVariables = nullptr;
+        });
+        break;
+    }
+    case UPNP_EVENT_RENEWAL_COMPLETE:
+    case UPNP_EVENT_AUTORENEWAL_FAILED:
+    case UPNP_EVENT_SUBSCRIPTION_EXPIRED:
+    {
+        // the renewal results are reported on the client callback, not on the subscribe callback
+        auto subEvent = *reinterpret_cast<Upnp_Event_Subscribe*>(pEvent);
+        pClient->dispatchEvent(subEvent.Sid, [eventType, subEvent] () mutable {
+            onSubscriptionEvent(eventType, &subEvent);
+        });
         break;
+    }
     default:
         break;
     }
@@ -244,29 +771,116 @@ int Client::upnpCallback(Upnp_EventType eventType, void* pEvent, void* pCookie)
     return 0;
 }
 
+void Client::dispatchEvent(const std::string& orderingKey, std::function<void()> event, const std::string& coalesceKey)
+{
+    if (m_eventQueue)
+    {
+        m_eventQueue->push(orderingKey, std::move(event), coalesceKey);
+    }
+    else
+    {
+        event();
+    }
+}
+
+void Client::onEventReceived(Upnp_Event* pEvent)
+{
+    // route the event to the subscriber that owns the subscription id
+    auto sub = findSubscriber(pEvent->Sid);
+    if (sub)
+    {
+        sub->onServiceEvent(UPNP_EVENT_RECEIVED, pEvent);
+    }
+
+    UPnPEventOccurredEvent(pEvent);
+}
+
+void Client::onSubscriptionEvent(Upnp_EventType eventType, Upnp_Event_Subscribe* pEvent)
+{
+    std::string sid = pEvent->Sid;
+    auto sub = findSubscriber(sid);
+    if (eventType != UPNP_EVENT_RENEWAL_COMPLETE)
+    {
+        updateSubscriptions([&] (Subscriptions& subscriptions) {
+            subscriptions.sids.erase(sid);
+        });
+    }
+
+    if (sub)
+    {
+        sub->onServiceEvent(eventType, pEvent);
+    }
+}
+
 int Client::upnpServiceCallback(Upnp_EventType eventType, void* pEvent, void* pCookie)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<IServiceSubscriber> sub;
+    {
+        auto subscriptions = std::atomic_load(&m_serviceSubscriptions);
+        auto iter = subscriptions->subscribers.find(reinterpret_cast<IServiceSubscriber*>(pCookie));
+        if (iter != subscriptions->subscribers.end())
+        {
+            sub = iter->second.lock();
+        }
+    }
 
-    try
+    if (sub && eventType == UPNP_EVENT_SUBSCRIBE_COMPLETE)
     {
-        auto sub = m_serviceSubscriptions.at(reinterpret_cast<IServiceSubscriber*>(pCookie)).lock();
-        if (sub)
+        auto pSubEvent = reinterpret_cast<Upnp_Event_Subscribe*>(pEvent);
+        if (pSubEvent->ErrCode == UPNP_E_SUCCESS)
         {
-            sub->onServiceEvent(eventType, pEvent);
+            std::string sid = pSubEvent->Sid;
+            updateSubscriptions([&] (Subscriptions& subscriptions) {
+                subscriptions.sids[sid] = sub;
+            });
         }
     }
-    catch (std::out_of_range&) {}
-
-    // auto iter = m_serviceSubscriptions.find(subPtr);
-    // if (iter != m_serviceSubscriptions.end())
-    // {
-    //     auto sub = iter->second.lock();
-    //     if (sub)
-    //     {
-    //         sub->onServiceEvent(eventType, pEvent);
-    //     }
-    // }
+
+    // the subscriber is kept alive during the callback, no locks are held so slow
+    // handlers do not delay the events of other subscriptions
+    if (sub)
+    {
+        sub->onServiceEvent(eventType, pEvent);
+    }
+
+    return 0;
+}
+
+int Client::upnpActionCallback(Upnp_EventType eventType, void* pEvent, void* pCookie)
+{
+    std::unique_ptr<ActionResultCb> cb(reinterpret_cast<ActionResultCb*>(pCookie));
+    if (!cb)
+    {
+        log::error("Action callback without a result callback");
+        return 0;
+    }
+
+    // the result callback is always called, otherwise the caller waits forever
+    int32_t errorCode = UPNP_E_BAD_RESPONSE;
+    xml::Document result;
+
+    auto pActionEvent = reinterpret_cast<Upnp_Action_Complete*>(pEvent);
+    if (eventType != UPNP_CONTROL_ACTION_COMPLETE || !pActionEvent)
+    {
+        log::warn("Unexpected action callback event: {}", eventType);
+    }
+    else
+    {
+        // take ownership of the result, libupnp frees the document after the callback
+        // returns, freeing a null document is a no-op
+        errorCode = pActionEvent->ErrCode;
+        result = xml::Document(pActionEvent->ActionResult);
+        pActionEvent->ActionResult = nullptr;
+    }
+
+    try
+    {
+        (*cb)(errorCode, std::move(result));
+    }
+    catch (std::exception& e)
+    {
+        log::error("Action result callback failed: {}", e.what());
+    }
 
     return 0;
 }
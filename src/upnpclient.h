@@ -19,9 +19,19 @@
 
 #include "upnp/upnpclientinterface.h"
 
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+struct Upnp_Event_Subscribe;
+
 namespace upnp
 {
 
+class EventQueue;
+
 class Client : public IClient
 {
 public:
@@ -35,6 +45,10 @@ public:
     virtual void destroy() override;
     virtual void reset() override;
 
+    virtual void setMaxContentLength(size_t bytes) override;
+    virtual void setEventQueueSettings(const EventQueueSettings& settings) override;
+    virtual uint64_t getDroppedEventCount() const override;
+
     virtual std::string getIpAddress() const override;
     virtual int32_t getPort() const override;
 
@@ -48,21 +62,56 @@ public:
     virtual void unsubscribeFromService(const std::shared_ptr<IServiceSubscriber>& sub) const override;
 
     virtual xml::Document sendAction(const Action& action) const override;
+    virtual void sendActionAsync(Action action, const ActionResultCb& cb) const override;
+    virtual void setConnectionPool(const std::shared_ptr<HttpConnectionPool>& pool) override;
+    virtual void setActionCoalescing(const std::set<std::string>& actionNames, std::chrono::milliseconds resultTimeToLive) override;
     virtual xml::Document downloadXmlDocument(const std::string& url) const override;
 
+    virtual void setDocumentCache(std::chrono::seconds timeToLive, uint64_t maxSizeInBytes) override;
+    virtual void clearDocumentCache() override;
+
  private:
+    xml::Document performAction(const Action& action) const;
     static int upnpCallback(Upnp_EventType EventType, void* pEvent, void* pcookie);
+    void dispatchEvent(const std::string& orderingKey, std::function<void()> event, const std::string& coalesceKey = "");
+    void onEventReceived(Upnp_Event* pEvent);
     static int upnpServiceCallback(Upnp_EventType EventType, void* pEvent, void* pcookie);
+    static int upnpActionCallback(Upnp_EventType EventType, void* pEvent, void* pcookie);
     static const char* deviceTypeToString(DeviceType type);
+    static void onSubscriptionEvent(Upnp_EventType eventType, Upnp_Event_Subscribe* pEvent);
+    static std::shared_ptr<IServiceSubscriber> findSubscriber(const std::string& sid);
+    static void removeSubscriber(IServiceSubscriber* sub);
+    template <typename Func>
+    static void updateSubscriptions(Func&& modify);
 
     class UpnpInitialization;
     class ClientHandle;
+    class DocumentCache;
+    class InFlightActions;
 
     std::unique_ptr<UpnpInitialization>                                         m_upnp;
     std::unique_ptr<ClientHandle>                                               m_client;
-
+    std::unique_ptr<DocumentCache>                                              m_documentCache;
+    std::unique_ptr<InFlightActions>                                            m_inFlightActions;
+    // only accessed with atomic_load/atomic_store, it can be replaced while actions are executed
+    std::shared_ptr<HttpConnectionPool>                                         m_connectionPool;
+    // read by the action threads, can be changed at any time
+    std::atomic<size_t>                                                         m_maxContentLength;
+    EventQueueSettings                                                          m_eventQueueSettings;
+    std::unique_ptr<EventQueue>                                                 m_eventQueue;
+
+    struct Subscriptions
+    {
+        // keyed on the cookie of the subscription callback
+        std::map<IServiceSubscriber*, std::weak_ptr<IServiceSubscriber>>                subscribers;
+        // keyed on the subscription id, used to route the received events
+        std::unordered_map<std::string, std::weak_ptr<IServiceSubscriber>>              sids;
+    };
+
+    // the subscriptions are published as an immutable snapshot, the event callbacks
+    // read the snapshot without locking. The mutex only serializes modifications.
     static std::mutex                                                           m_mutex;
-    static std::map<IServiceSubscriber*, std::weak_ptr<IServiceSubscriber>>     m_serviceSubscriptions;
+    static std::shared_ptr<const Subscriptions>                                 m_serviceSubscriptions;
 };
 
 }
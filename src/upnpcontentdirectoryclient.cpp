@@ -45,7 +45,7 @@ Client::Client(IClient& client)
     ixmlRelaxParser(1);
 }
 
-void Client::setDevice(const std::shared_ptr<Device>& device)
+void Client::setDevice(const std::shared_ptr<const Device>& device)
 {
     ServiceClientBase::setDevice(device);
 
@@ -115,8 +115,7 @@ Item Client::browseMetadata(const std::string& objectId, const std::string& filt
 {
     ActionResult res;
 
-    xml::Document result = browseAction(objectId, "BrowseMetadata", filter, 0, 0, "");
-    xml::Document browseResult = parseBrowseResult(result, res);
+    xml::Document browseResult = parseBrowseResult(browseAction(objectId, "BrowseMetadata", filter, 0, 0, ""), res);
     if (!browseResult)
     {
         throw Exception("Failed to browse meta data");
@@ -135,7 +134,7 @@ ActionResult Client::browseDirectChildren(BrowseType type, const std::string& ob
     ActionResult res;
 
     xml::Document result = browseAction(objectId, "BrowseDirectChildren", filter, startIndex, limit, sort);
-    xml::Document browseResult = parseBrowseResult(result, res);
+    xml::Document browseResult = parseBrowseResult(std::move(result), res);
     if (!browseResult)
     {
         throw Exception("Failed to browse direct children");
@@ -179,7 +178,7 @@ ActionResult Client::search(const std::string& objectId, const std::string& crit
                                                            {"SortCriteria", sort} });
 
     ActionResult searchResult;
-    xml::Document searchResultDoc = parseBrowseResult(result, searchResult);
+    xml::Document searchResultDoc = parseBrowseResult(std::move(result), searchResult);
     if (!searchResultDoc)
     {
         throw Exception("Failed to perform search");
@@ -217,7 +216,7 @@ xml::Document Client::browseAction(const std::string& objectId, const std::strin
                                            {"SortCriteria", sort} });
 }
 
-xml::Document Client::parseBrowseResult(xml::Document& doc, ActionResult& result)
+xml::Document Client::parseBrowseResult(xml::Document doc, ActionResult& result)
 {
     std::string browseResult;
 
@@ -248,6 +247,9 @@ xml::Document Client::parseBrowseResult(xml::Document& doc, ActionResult& result
         throw Exception("Failed to obtain browse result");
     }
 
+    // release the SOAP response before parsing the DIDL, the response DOM and the DIDL DOM are not kept at the same time
+    doc = xml::Document();
+
     return xml::Document(browseResult);
 }
 
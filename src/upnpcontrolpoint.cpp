@@ -44,7 +44,7 @@ void ControlPoint::setWebserver(WebServer& webServer)
     m_pWebServer->addVirtualDirectory("playlists");
 }
 
-void ControlPoint::setRendererDevice(const std::shared_ptr<Device>& dev)
+void ControlPoint::setRendererDevice(const std::shared_ptr<const Device>& dev)
 {
     m_renderer.setDevice(dev);
     m_renderer.useDefaultConnection();
@@ -106,8 +106,9 @@ void ControlPoint::playItemsAsPlaylist(upnp::MediaServer &server, const std::vec
         }
     }
 
+    // the new playlist replaces the playback, the previous playlists are no longer needed
     std::string filename = generatePlaylistFilename();
-    m_pWebServer->addFile("playlists", filename, "audio/m3u", playlist.str());
+    addPlaylistFile(filename, playlist.str(), 0);
     playItem(server, createPlaylistItem(filename));
 }
 
@@ -147,8 +148,9 @@ void ControlPoint::queueItemsAsPlaylist(upnp::MediaServer &server, const std::ve
         }
     }
 
+    // the playlist that is currently playing is kept
     std::string filename = generatePlaylistFilename();
-    m_pWebServer->addFile("playlists", filename, "audio/m3u", playlist.str());
+    addPlaylistFile(filename, playlist.str(), 1);
     queueItem(server, createPlaylistItem(filename));
 }
 
@@ -171,6 +173,18 @@ void ControlPoint::throwOnMissingWebserver()
     }
 }
 
+void ControlPoint::addPlaylistFile(const std::string& filename, const std::string& playlist, size_t keepPrevious)
+{
+    m_pWebServer->addFile("playlists", filename, "audio/m3u", playlist);
+    m_playlists.push_back(filename);
+
+    while (m_playlists.size() > keepPrevious + 1)
+    {
+        m_pWebServer->removeFile("playlists", m_playlists.front());
+        m_playlists.pop_front();
+    }
+}
+
 std::string ControlPoint::generatePlaylistFilename()
 {
     std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
@@ -0,0 +1,142 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#include "upnpdevicedescription.h"
+#include "upnp/upnpxml.h"
+
+#include <cstring>
+
+namespace upnp
+{
+
+namespace
+{
+
+// the element name without the namespace prefix
+const char* getElementName(IXML_Node* node)
+{
+    const char* name = ixmlNode_getNodeName(node);
+    if (!name)
+    {
+        return "";
+    }
+
+    const char* prefixEnd = strchr(name, ':');
+    return prefixEnd ? prefixEnd + 1 : name;
+}
+
+std::string getElementText(IXML_Node* node)
+{
+    IXML_Node* textNode = ixmlNode_getFirstChild(node);
+    const char* value = textNode ? ixmlNode_getNodeValue(textNode) : nullptr;
+    return value ? value : "";
+}
+
+template <typename Func>
+void forEachChildElement(IXML_Node* node, Func&& func)
+{
+    for (IXML_Node* child = ixmlNode_getFirstChild(node); child != nullptr; child = ixmlNode_getNextSibling(child))
+    {
+        if (ixmlNode_getNodeType(child) == eELEMENT_NODE)
+        {
+            func(child, getElementName(child));
+        }
+    }
+}
+
+void parseServiceList(IXML_Node* serviceList, std::vector<ServiceDescription>& services)
+{
+    forEachChildElement(serviceList, [&] (IXML_Node* serviceNode, const char* name) {
+        if (strcmp(name, "service") != 0)
+        {
+            return;
+        }
+
+        ServiceDescription service;
+        forEachChildElement(serviceNode, [&] (IXML_Node* node, const char* field) {
+            if      (strcmp(field, "serviceType") == 0) { service.type = getElementText(node); }
+            else if (strcmp(field, "serviceId") == 0)   { service.id = getElementText(node); }
+            else if (strcmp(field, "SCPDURL") == 0)     { service.scpdURL = getElementText(node); }
+            else if (strcmp(field, "controlURL") == 0)  { service.controlURL = getElementText(node); }
+            else if (strcmp(field, "eventSubURL") == 0) { service.eventSubURL = getElementText(node); }
+        });
+
+        services.push_back(std::move(service));
+    });
+}
+
+// the fields of the root device are stored, the embedded devices only contribute their services
+void parseDevice(IXML_Node* deviceNode, bool rootDevice, DeviceDescription& description)
+{
+    std::vector<IXML_Node*> embeddedDevices;
+
+    forEachChildElement(deviceNode, [&] (IXML_Node* node, const char* name) {
+        if (strcmp(name, "serviceList") == 0)
+        {
+            parseServiceList(node, description.services);
+        }
+        else if (strcmp(name, "deviceList") == 0)
+        {
+            forEachChildElement(node, [&] (IXML_Node* embeddedNode, const char* embeddedName) {
+                if (strcmp(embeddedName, "device") == 0)
+                {
+                    embeddedDevices.push_back(embeddedNode);
+                }
+            });
+        }
+        else if (rootDevice)
+        {
+            if      (strcmp(name, "deviceType") == 0)       { description.deviceType = getElementText(node); }
+            else if (strcmp(name, "friendlyName") == 0)     { description.friendlyName = getElementText(node); }
+            else if (strcmp(name, "UDN") == 0)              { description.udn = getElementText(node); }
+            else if (strcmp(name, "presentationURL") == 0)  { description.presentationURL = getElementText(node); }
+        }
+    });
+
+    for (auto embeddedNode : embeddedDevices)
+    {
+        parseDevice(embeddedNode, false, description);
+    }
+}
+
+}
+
+DeviceDescription parseDeviceDescription(const xml::Document& doc)
+{
+    DeviceDescription description;
+
+    forEachChildElement(doc, [&] (IXML_Node* rootNode, const char* rootName) {
+        if (strcmp(rootName, "root") != 0)
+        {
+            return;
+        }
+
+        forEachChildElement(rootNode, [&] (IXML_Node* node, const char* name) {
+            if (strcmp(name, "URLBase") == 0)
+            {
+                description.baseURL = getElementText(node);
+            }
+            else if (strcmp(name, "device") == 0 && description.deviceType.empty())
+            {
+                parseDevice(node, true, description);
+            }
+        });
+    });
+
+    return description;
+}
+
+}
@@ -0,0 +1,56 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef UPNP_DEVICE_DESCRIPTION_H
+#define UPNP_DEVICE_DESCRIPTION_H
+
+#include <string>
+#include <vector>
+
+namespace upnp
+{
+
+namespace xml
+{
+class Document;
+}
+
+struct ServiceDescription
+{
+    std::string type;
+    std::string id;
+    std::string scpdURL;
+    std::string controlURL;
+    std::string eventSubURL;
+};
+
+struct DeviceDescription
+{
+    std::string                     baseURL;
+    std::string                     deviceType;
+    std::string                     friendlyName;
+    std::string                     udn;
+    std::string                     presentationURL;
+    // the services of the root device first, followed by the ones of the embedded devices
+    std::vector<ServiceDescription> services;
+};
+
+// parses the device description document in a single traversal
+DeviceDescription parseDeviceDescription(const xml::Document& doc);
+
+}
+
+#endif
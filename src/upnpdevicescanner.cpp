@@ -17,10 +17,15 @@
 #include "upnp/upnpdevicescanner.h"
 #include "upnp/upnpclientinterface.h"
 #include "upnp/upnptypes.h"
+#include "upnpdevicedescription.h"
 
 #include "utils/log.h"
 
 #include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
 #include <algorithm>
 #include <upnptools.h>
 
@@ -34,8 +39,58 @@ using namespace std::placeholders;
 using namespace std::chrono;
 using namespace std::chrono_literals;
 
-static const auto g_timeCheckInterval = 60s;
-static const int32_t g_searchTimeoutInSec = 5;
+namespace
+{
+
+const int32_t g_searchTimeoutInSec = 5;
+
+std::string resolveUrl(const std::string& base, const std::string& relativeUrl)
+{
+    char url[512];
+    if (UpnpResolveURL(base.c_str(), relativeUrl.c_str(), url) != UPNP_E_SUCCESS)
+    {
+        log::error("Error resolving url {} relative to {}", relativeUrl, base);
+        return "";
+    }
+
+    return url;
+}
+
+// the optional services are only used when the required services of the device type are available
+std::map<ServiceType, Service> selectSupportedServices(DeviceType type, const std::map<ServiceType, Service>& services)
+{
+    std::map<ServiceType, Service> supported;
+    auto addService = [&] (ServiceType serviceType) {
+        auto iter = services.find(serviceType);
+        if (iter == services.end())
+        {
+            return false;
+        }
+
+        supported.emplace(serviceType, iter->second);
+        return true;
+    };
+
+    if (type == DeviceType::MediaServer)
+    {
+        if (addService(ServiceType::ContentDirectory))
+        {
+            addService(ServiceType::AVTransport);
+            addService(ServiceType::ConnectionManager);
+        }
+    }
+    else if (type == DeviceType::MediaRenderer)
+    {
+        if (addService(ServiceType::RenderingControl) && addService(ServiceType::ConnectionManager))
+        {
+            addService(ServiceType::AVTransport);
+        }
+    }
+
+    return supported;
+}
+
+}
 
 DeviceScanner::DeviceScanner(IClient& client, DeviceType type)
 : DeviceScanner(client, std::set<DeviceType> { type })
@@ -47,6 +102,7 @@ DeviceScanner::DeviceScanner(IClient& client, std::set<DeviceType> types)
 , m_types(types)
 , m_started(false)
 , m_stop(false)
+, m_snapshot(std::make_shared<const DeviceSnapshot>())
 {
 }
 
@@ -57,35 +113,61 @@ DeviceScanner::~DeviceScanner() throw()
 
 void DeviceScanner::onDeviceDissapeared(const std::string& deviceId)
 {
-    std::lock_guard<std::mutex> lock(m_dataMutex);
-    auto iter = m_devices.find(deviceId);
-    if (iter != m_devices.end())
+    std::shared_ptr<const Device> device;
     {
-        DeviceDissapearedEvent(iter->second);
+        std::lock_guard<std::mutex> lock(m_dataMutex);
+        auto iter = m_devices.find(deviceId);
+        if (iter == m_devices.end())
+        {
+            return;
+        }
+
+        device = iter->second;
         m_devices.erase(iter);
+        cancelExpiry(deviceId);
+        publishDevices();
     }
+
+    DeviceDissapearedEvent(device);
 }
 
-void DeviceScanner::start()
+void DeviceScanner::setCacheFile(const std::string& path)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    if (m_started)
+    m_cacheFile = path;
+}
+
+void DeviceScanner::start()
+{
+    std::string cacheFile;
     {
-        return;
-    }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_started)
+        {
+            return;
+        }
+
+        log::debug("Start device scanner, known devices ({})", m_devices.size());
 
-    log::debug("Start device scanner, known devices ({})", m_devices.size());
+        m_client.UPnPDeviceDiscoveredEvent.connect(std::bind(&DeviceScanner::onDeviceDiscovered, this, _1), this);
+        m_client.UPnPDeviceDissapearedEvent.connect(std::bind(&DeviceScanner::onDeviceDissapeared, this, _1), this);
 
-    m_client.UPnPDeviceDiscoveredEvent.connect(std::bind(&DeviceScanner::onDeviceDiscovered, this, _1), this);
-    m_client.UPnPDeviceDissapearedEvent.connect(std::bind(&DeviceScanner::onDeviceDissapeared, this, _1), this);
+        m_thread = std::async(std::launch::async, std::bind(&DeviceScanner::checkForTimeoutThread, this));
+        m_downloadPool.start();
+        m_started = true;
+        cacheFile = m_cacheFile;
+    }
 
-    m_thread = std::async(std::launch::async, std::bind(&DeviceScanner::checkForTimeoutThread, this));
-    m_downloadPool.start();
-    m_started = true;
+    // the cached devices are signaled, not under the lock
+    if (!cacheFile.empty())
+    {
+        loadCache(cacheFile);
+    }
 }
 
 void DeviceScanner::stop()
 {
+    std::string cacheFile;
     {
         std::lock_guard<std::mutex> lock(m_mutex);
         if (!m_started)
@@ -96,209 +178,420 @@ void DeviceScanner::stop()
         m_client.UPnPDeviceDiscoveredEvent.disconnect(this);
         m_client.UPnPDeviceDissapearedEvent.disconnect(this);
 
-        m_stop = true;
+        {
+            // the timeout thread waits on the data mutex
+            std::lock_guard<std::mutex> dataLock(m_dataMutex);
+            m_stop = true;
+        }
+
         m_condition.notify_all();
         m_downloadPool.stop();
+        cacheFile = m_cacheFile;
     }
 
     m_thread.wait();
     m_stop = false;
     m_started = false;
 
-    log::debug("Stop device scanner, known devices ({})", m_devices.size());
+    {
+        // the pending jobs of the download pool are discarded
+        std::lock_guard<std::mutex> lock(m_dataMutex);
+        m_pendingDownloads.clear();
+    }
+
+    log::debug("Stop device scanner, known devices ({})", getDeviceCount());
+
+    if (!cacheFile.empty())
+    {
+        saveCache(cacheFile);
+    }
 }
 
-void DeviceScanner::checkForTimeoutThread()
+void DeviceScanner::loadCache(const std::string& path)
 {
-    while (!m_stop)
+    std::vector<std::shared_ptr<Device>> devices;
+
+    try
     {
-        std::unique_lock<std::mutex> lock(m_dataMutex);
+        std::ifstream file(path);
+        if (!file)
+        {
+            // nothing cached yet
+            return;
+        }
 
-        system_clock::time_point now = system_clock::now();
-        auto mapEnd = m_devices.end();
-        for (auto iter = m_devices.begin(); iter != mapEnd;)
+        std::stringstream contents;
+        contents << file.rdbuf();
+        xml::Document doc(contents.str());
+
+        auto now = system_clock::now();
+        for (xml::Element deviceElem : doc.getElementsByTagName("device"))
         {
-            if (now > iter->second->m_timeoutTime)
+            // a malformed entry only skips that device
+            try
             {
-                auto dev = iter->second;
+                auto device = std::make_shared<Device>();
+                device->m_type          = Device::stringToDeviceType(deviceElem.getAttribute("type"));
+                device->m_timeoutTime   = system_clock::from_time_t(static_cast<time_t>(std::stoll(deviceElem.getAttribute("timeout"))));
+
+                if (m_types.find(device->m_type) == m_types.end() || device->m_timeoutTime <= now)
+                {
+                    continue;
+                }
 
-                log::info("Device timed out removing it from the list: {}", iter->second->m_friendlyName);
-                iter = m_devices.erase(iter);
+                device->m_udn           = deviceElem.getAttribute("udn");
+                device->m_friendlyName  = deviceElem.getAttributeOptional("friendlyName");
+                device->m_baseURL       = deviceElem.getAttributeOptional("baseURL");
+                device->m_relURL        = deviceElem.getAttributeOptional("relURL");
+                device->m_presURL       = deviceElem.getAttributeOptional("presURL");
+                device->m_location      = deviceElem.getAttribute("location");
+                device->m_verified      = false;
 
-                DeviceDissapearedEvent(dev);
+                for (xml::Element serviceElem : deviceElem.getElementsByTagName("service"))
+                {
+                    Service service;
+                    service.m_type                  = serviceTypeUrnStringToService(serviceElem.getAttribute("type"));
+                    service.m_id                    = serviceElem.getAttribute("id");
+                    service.m_scpdUrl               = serviceElem.getAttribute("scpdURL");
+                    service.m_controlURL            = serviceElem.getAttribute("controlURL");
+                    service.m_eventSubscriptionURL  = serviceElem.getAttribute("eventSubURL");
+                    device->m_services[service.m_type] = service;
+                }
+
+                devices.push_back(device);
             }
-            else
+            catch (std::exception& e)
             {
-                ++iter;
+                log::warn("Skipping invalid device in the device cache {}: {}", path, e.what());
             }
         }
+    }
+    catch (std::exception& e)
+    {
+        log::warn("Failed to load the device cache {}: {}", path, e.what());
+        return;
+    }
 
-        if (std::cv_status::no_timeout == m_condition.wait_for(lock, g_timeCheckInterval))
+    std::vector<std::shared_ptr<const Device>> addedDevices;
+    {
+        std::lock_guard<std::mutex> lock(m_dataMutex);
+        for (auto& device : devices)
         {
-            return;
+            if (m_devices.emplace(device->m_udn, device).second)
+            {
+                scheduleExpiry(device->m_udn, device->m_timeoutTime);
+                addedDevices.push_back(device);
+            }
         }
+
+        publishDevices();
+    }
+
+    log::debug("Loaded {} devices from the cache", addedDevices.size());
+
+    for (auto& device : addedDevices)
+    {
+        DeviceDiscoveredEvent(device);
+        revalidateDevice(device);
     }
 }
 
-void DeviceScanner::refresh()
+void DeviceScanner::saveCache(const std::string& path) const
 {
-    if (m_types.size() == 1)
+    try
     {
-        m_client.searchDevicesOfType(*m_types.begin(), g_searchTimeoutInSec);
+        xml::Document doc;
+        auto devicesElem = doc.createElement("devices");
+
+        // the renewed deadlines are only kept in the expiry queue, not in the published devices
+        std::vector<std::pair<std::shared_ptr<const Device>, system_clock::time_point>> devices;
+        {
+            std::lock_guard<std::mutex> lock(m_dataMutex);
+            for (auto& dev : m_devices)
+            {
+                devices.emplace_back(dev.second, getExpiry(dev.first));
+            }
+        }
+
+        for (auto& dev : devices)
+        {
+            auto& device = *dev.first;
+
+            auto deviceElem = doc.createElement("device");
+            deviceElem.addAttribute("udn", device.m_udn);
+            deviceElem.addAttribute("type", Device::deviceTypeToString(device.m_type));
+            deviceElem.addAttribute("friendlyName", device.m_friendlyName);
+            deviceElem.addAttribute("baseURL", device.m_baseURL);
+            deviceElem.addAttribute("relURL", device.m_relURL);
+            deviceElem.addAttribute("presURL", device.m_presURL);
+            deviceElem.addAttribute("location", device.m_location);
+            deviceElem.addAttribute("timeout", std::to_string(static_cast<int64_t>(system_clock::to_time_t(dev.second))));
+
+            for (auto& svc : device.m_services)
+            {
+                auto& service = svc.second;
+
+                auto serviceElem = doc.createElement("service");
+                serviceElem.addAttribute("type", serviceTypeToUrnTypeString(service.m_type));
+                serviceElem.addAttribute("id", service.m_id);
+                serviceElem.addAttribute("scpdURL", service.m_scpdUrl);
+                serviceElem.addAttribute("controlURL", service.m_controlURL);
+                serviceElem.addAttribute("eventSubURL", service.m_eventSubscriptionURL);
+                deviceElem.appendChild(serviceElem);
+            }
+
+            devicesElem.appendChild(deviceElem);
+        }
+
+        doc.appendChild(devicesElem);
+
+        // written to a temporary file first, an interrupted write keeps the previous cache
+        auto tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::trunc);
+            file << doc.toString();
+            if (!file)
+            {
+                throw Exception("Failed to write {}", tempPath);
+            }
+        }
+
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            throw Exception("Failed to rename {}", tempPath);
+        }
     }
-    else
+    catch (std::exception& e)
     {
-        m_client.searchAllDevices(g_searchTimeoutInSec);
+        log::warn("Failed to save the device cache {}: {}", path, e.what());
     }
 }
 
-uint32_t DeviceScanner::getDeviceCount() const
+void DeviceScanner::revalidateDevice(const std::shared_ptr<const Device>& device)
 {
-    std::lock_guard<std::mutex> lock(m_dataMutex);
-    return static_cast<uint32_t>(m_devices.size());
-}
+    DeviceDiscoverInfo info;
+    info.deviceId       = device->m_udn;
+    info.deviceType     = Device::deviceTypeToString(device->m_type);
+    info.location       = device->m_location;
+    info.expirationTime = static_cast<uint32_t>(std::max<int64_t>(0, duration_cast<seconds>(device->m_timeoutTime - system_clock::now()).count()));
 
-std::shared_ptr<Device> DeviceScanner::getDevice(const std::string& udn) const
-{
-    std::lock_guard<std::mutex> lock(m_dataMutex);
-    return m_devices.at(udn);
-}
+    m_downloadPool.addJob([this, info, device] () {
+        auto current = std::make_shared<Device>();
+        bool available = false;
 
-std::map<std::string, std::shared_ptr<Device>> DeviceScanner::getDevices() const
-{
-    std::lock_guard<std::mutex> lock(m_dataMutex);
-    return m_devices;
+        try
+        {
+            obtainDeviceDetails(info, current);
+            available = (current->m_udn == info.deviceId);
+        }
+        catch (std::exception& e)
+        {
+            log::warn("Failed to revalidate cached device {}: {}", device->m_friendlyName, e.what());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_dataMutex);
+            auto iter = m_devices.find(info.deviceId);
+            if (iter == m_devices.end() || iter->second != device || device->m_verified)
+            {
+                // removed or already verified by an advertisement in the meantime
+                return;
+            }
+
+            if (available)
+            {
+                // the downloaded details replace the cached instance
+                current->m_timeoutTime = getExpiry(info.deviceId);
+                iter->second = current;
+                publishDevices();
+                return;
+            }
+
+            m_devices.erase(iter);
+            cancelExpiry(info.deviceId);
+            publishDevices();
+        }
+
+        log::info("Cached device is no longer available: {}", device->m_friendlyName);
+        DeviceDissapearedEvent(device);
+    });
 }
 
-void DeviceScanner::obtainDeviceDetails(const DeviceDiscoverInfo& info, const std::shared_ptr<Device>& device)
+void DeviceScanner::checkForTimeoutThread()
 {
-    xml::Document doc = m_client.downloadXmlDocument(info.location);
+    std::unique_lock<std::mutex> lock(m_dataMutex);
+    while (!m_stop)
+    {
+        std::vector<std::shared_ptr<const Device>> expiredDevices;
 
-    device->m_location      = info.location;
-    device->m_udn           = doc.getChildNodeValueRecursive("UDN");
-    device->m_type          = Device::stringToDeviceType(doc.getChildNodeValueRecursive("deviceType"));
-    device->m_timeoutTime   = system_clock::now() + seconds(info.expirationTime);
+        auto now = system_clock::now();
+        while (!m_expiryQueue.empty() && m_expiryQueue.begin()->first <= now)
+        {
+            auto udn = m_expiryQueue.begin()->second;
+            cancelExpiry(udn);
 
-    assert(m_types.find(device->m_type) != m_types.end());
+            auto iter = m_devices.find(udn);
+            if (iter == m_devices.end())
+            {
+                continue;
+            }
 
-    if (device->m_udn.empty())
-    {
-        return;
-    }
+            log::info("Device timed out removing it from the list: {}", iter->second->m_friendlyName);
+            expiredDevices.push_back(iter->second);
+            m_devices.erase(iter);
+        }
 
-    device->m_friendlyName   = doc.getChildNodeValueRecursive("friendlyName");
-    try { device->m_baseURL  = doc.getChildNodeValueRecursive("URLBase"); } catch (std::exception&) {}
-    try { device->m_relURL   = doc.getChildNodeValueRecursive("presentationURL"); } catch (std::exception&) {}
+        if (!expiredDevices.empty())
+        {
+            publishDevices();
 
-    char presURL[200];
-    int ret = UpnpResolveURL((device->m_baseURL.empty() ? device->m_baseURL.c_str() : info.location.c_str()), device->m_relURL.empty() ? nullptr : device->m_relURL.c_str(), presURL);
-    if (UPNP_E_SUCCESS == ret)
-    {
-        device->m_presURL = presURL;
-    }
+            // not signaled under the lock, the handlers are allowed to access the scanner
+            lock.unlock();
+            for (auto& device : expiredDevices)
+            {
+                DeviceDissapearedEvent(device);
+            }
+            lock.lock();
+            continue;
+        }
 
-    if (device->m_type == DeviceType::MediaServer)
-    {
-        if (findAndParseService(doc, ServiceType::ContentDirectory, device))
+        // wake up at the next deadline, scheduling an earlier deadline notifies the condition
+        if (m_expiryQueue.empty())
         {
-            // try to obtain the optional services
-            findAndParseService(doc, ServiceType::AVTransport, device);
-            findAndParseService(doc, ServiceType::ConnectionManager, device);
+            m_condition.wait(lock);
         }
-    }
-    else if (device->m_type == DeviceType::MediaRenderer)
-    {
-        if (findAndParseService(doc, ServiceType::RenderingControl, device) &&
-            findAndParseService(doc, ServiceType::ConnectionManager, device))
+        else
         {
-            // try to obtain the optional services
-            findAndParseService(doc, ServiceType::AVTransport, device);
+            m_condition.wait_until(lock, m_expiryQueue.begin()->first);
         }
     }
 }
 
-xml::NodeList DeviceScanner::getFirstServiceList(xml::Document& doc)
+void DeviceScanner::scheduleExpiry(const std::string& udn, system_clock::time_point deadline)
 {
-    xml::NodeList serviceList;
+    cancelExpiry(udn);
+
+    auto entry = m_expiryQueue.emplace(deadline, udn);
+    m_expiryEntries[udn] = entry;
 
-    xml::NodeList servlistNodelist = doc.getElementsByTagName("serviceList");
-    if (servlistNodelist.size() > 0)
+    if (entry == m_expiryQueue.begin())
     {
-        xml::Element servlistElem = servlistNodelist.getNode(0);
-        return servlistElem.getElementsByTagName("service");
+        m_condition.notify_all();
     }
+}
 
-    return serviceList;
+system_clock::time_point DeviceScanner::getExpiry(const std::string& udn) const
+{
+    auto iter = m_expiryEntries.find(udn);
+    return iter == m_expiryEntries.end() ? system_clock::time_point() : iter->second->first;
 }
 
-bool DeviceScanner::findAndParseService(xml::Document& doc, const ServiceType serviceType, const std::shared_ptr<Device>& device)
+void DeviceScanner::cancelExpiry(const std::string& udn)
 {
-    bool found = false;
+    auto iter = m_expiryEntries.find(udn);
+    if (iter != m_expiryEntries.end())
+    {
+        m_expiryQueue.erase(iter->second);
+        m_expiryEntries.erase(iter);
+    }
+}
 
-    xml::NodeList serviceList = getFirstServiceList(doc);
-    if (!serviceList)
+void DeviceScanner::refresh()
+{
+    if (m_types.size() == 1)
+    {
+        m_client.searchDevicesOfType(*m_types.begin(), g_searchTimeoutInSec);
+    }
+    else
     {
-        return found;
+        m_client.searchAllDevices(g_searchTimeoutInSec);
     }
+}
+
+uint32_t DeviceScanner::getDeviceCount() const
+{
+    return static_cast<uint32_t>(getDeviceSnapshot()->devices.size());
+}
+
+std::shared_ptr<const Device> DeviceScanner::getDevice(const std::string& udn) const
+{
+    return getDeviceSnapshot()->devices.at(udn);
+}
+
+std::map<std::string, std::shared_ptr<const Device>> DeviceScanner::getDevices() const
+{
+    return getDeviceSnapshot()->devices;
+}
+
+std::shared_ptr<const DeviceSnapshot> DeviceScanner::getDeviceSnapshot() const
+{
+    return std::atomic_load(&m_snapshot);
+}
+
+void DeviceScanner::publishDevices()
+{
+    auto snapshot = std::make_shared<DeviceSnapshot>();
+    snapshot->version = m_snapshot->version + 1;
+    snapshot->devices = m_devices;
+
+    std::atomic_store(&m_snapshot, std::shared_ptr<const DeviceSnapshot>(std::move(snapshot)));
+}
 
-    std::string base = device->m_baseURL.empty() ? device->m_location : device->m_baseURL;
+void DeviceScanner::obtainDeviceDetails(const DeviceDiscoverInfo& info, const std::shared_ptr<Device>& device)
+{
+    xml::Document doc = m_client.downloadXmlDocument(info.location);
+    auto description = parseDeviceDescription(doc);
 
-    unsigned long numServices = serviceList.size();
-    for (unsigned long i = 0; i < numServices; ++i)
+    if (description.deviceType.empty())
     {
-        xml::Element serviceElem = serviceList.getNode(i);
+        throw Exception("Invalid device description, no device type: {}", info.location);
+    }
 
-        Service service;
-        service.m_type = serviceTypeUrnStringToService(serviceElem.getChildNodeValue("serviceType"));
-        if (service.m_type == serviceType)
-        {
-            service.m_id                    = serviceElem.getChildNodeValue("serviceId");
-            std::string relControlURL       = serviceElem.getChildNodeValue("controlURL");
-            std::string relEventURL         = serviceElem.getChildNodeValue("eventSubURL");
-            std::string scpURL              = serviceElem.getChildNodeValue("SCPDURL");
-
-            char url[512];
-            int ret = UpnpResolveURL(base.c_str(), relControlURL.c_str(), url);
-            if (ret != UPNP_E_SUCCESS)
-            {
-                log::error("Error generating controlURL from {} and {}", base, relControlURL);
-            }
-            else
-            {
-                service.m_controlURL = url;
-            }
+    device->m_location          = info.location;
+    device->m_udn               = description.udn;
+    device->m_type              = Device::stringToDeviceType(description.deviceType);
+    device->m_timeoutTime       = system_clock::now() + seconds(info.expirationTime);
 
-            ret = UpnpResolveURL(base.c_str(), relEventURL.c_str(), url);
-            if (ret != UPNP_E_SUCCESS)
-            {
-                log::error("Error generating eventURL from {} and {}", base, relEventURL);
-            }
-            else
-            {
-                service.m_eventSubscriptionURL = url;
-            }
+    assert(m_types.find(device->m_type) != m_types.end());
 
-            ret = UpnpResolveURL(base.c_str(), scpURL.c_str(), url);
-            if (ret != UPNP_E_SUCCESS)
-            {
-                log::error("Error generating eventURL from {} and {}", base, scpURL);
-            }
-            else
-            {
-                service.m_scpdUrl = url;
-            }
+    if (device->m_udn.empty())
+    {
+        return;
+    }
 
-            device->m_services[serviceType] = service;
+    device->m_friendlyName  = description.friendlyName;
+    device->m_baseURL       = description.baseURL;
+    device->m_relURL        = description.presentationURL;
 
-            found = true;
-            break;
+    // all the relative urls of the description are resolved against the same base
+    const std::string& base = device->m_baseURL.empty() ? device->m_location : device->m_baseURL;
+    if (!device->m_relURL.empty())
+    {
+        device->m_presURL = resolveUrl(base, device->m_relURL);
+    }
+
+    std::map<ServiceType, Service> services;
+    for (auto& serviceDescription : description.services)
+    {
+        auto type = serviceTypeUrnStringToService(serviceDescription.type);
+        if (type == ServiceType::Unknown || services.find(type) != services.end())
+        {
+            // the services of the root device take precedence over the ones of the embedded devices
+            continue;
         }
+
+        Service service;
+        service.m_type                  = type;
+        service.m_id                    = serviceDescription.id;
+        service.m_controlURL            = resolveUrl(base, serviceDescription.controlURL);
+        service.m_eventSubscriptionURL  = resolveUrl(base, serviceDescription.eventSubURL);
+        service.m_scpdUrl               = resolveUrl(base, serviceDescription.scpdURL);
+        services.emplace(type, service);
     }
 
-    return found;
+    device->m_services = selectSupportedServices(device->m_type, services);
 }
 
-
 void DeviceScanner::onDeviceDiscovered(const DeviceDiscoverInfo& info)
 {
     auto deviceType = Device::stringToDeviceType(info.deviceType);
@@ -313,50 +606,80 @@ void DeviceScanner::onDeviceDiscovered(const DeviceDiscoverInfo& info)
         auto iter = m_devices.find(info.deviceId);
         if (iter != m_devices.end())
         {
-            // device already known, just update the timeout time
-            iter->second->m_timeoutTime =  system_clock::now() + seconds(info.expirationTime);
+            // device already known, the renewal only moves its deadline in the expiry queue
+            auto deadline = system_clock::now() + seconds(info.expirationTime);
+            scheduleExpiry(info.deviceId, deadline);
+
+            if (!iter->second->m_verified)
+            {
+                // the first advertisement of a cached device verifies it, this is published as a copy
+                auto device = std::make_shared<Device>(*iter->second);
+                device->m_timeoutTime = deadline;
+                device->m_verified = true;
+                iter->second = device;
+                publishDevices();
+            }
 
             // check if the location is still the same (perhaps a new ip or port)
-            if (iter->second->m_location != std::string(info.location))
+            auto& device = iter->second;
+            if (device->m_location != info.location &&
+                m_pendingDownloads.emplace(info.deviceId, info.location).second)
             {
                 // update the device, ip or port has changed
-                log::debug("Update device, location has changed: {} -> {}", iter->second->m_location, std::string(info.location));
-                updateDevice(info, iter->second);
+                log::debug("Update device, location has changed: {} -> {}", device->m_location, info.location);
+                updateDevice(info);
             }
 
             return;
         }
+
+        // a device sends several responses and advertisements, the description is only downloaded once
+        if (!m_pendingDownloads.emplace(info.deviceId, info.location).second)
+        {
+            return;
+        }
     }
 
     m_downloadPool.addJob([this, info] () {
+        auto device = std::make_shared<Device>();
+
         try
         {
-            auto device = std::make_shared<Device>();
             obtainDeviceDetails(info, device);
+        }
+        catch (std::exception& e)
+        {
+            log::error(e.what());
+            device.reset();
+        }
 
-            {
-                std::lock_guard<std::mutex> lock(m_dataMutex);
-                auto iter = m_devices.find(device->m_udn);
-                if (iter == m_devices.end())
-                {
-                    log::info("Device added to the list: {} ({})", device->m_friendlyName, device->m_udn);
-                    m_devices.emplace(device->m_udn, device);
+        bool added = false;
+        {
+            std::lock_guard<std::mutex> lock(m_dataMutex);
+            m_pendingDownloads.erase(std::make_pair(info.deviceId, info.location));
 
-                    m_dataMutex.unlock();
-                    DeviceDiscoveredEvent(device);
-                }
+            if (device && m_devices.find(device->m_udn) == m_devices.end())
+            {
+                log::info("Device added to the list: {} ({})", device->m_friendlyName, device->m_udn);
+                m_devices.emplace(device->m_udn, device);
+                scheduleExpiry(device->m_udn, device->m_timeoutTime);
+                publishDevices();
+                added = true;
             }
         }
-        catch (std::exception& e)
+
+        if (added)
         {
-            log::error(e.what());
+            DeviceDiscoveredEvent(device);
         }
     });
 }
 
-void DeviceScanner::updateDevice(const DeviceDiscoverInfo& info, const std::shared_ptr<Device>& device)
+void DeviceScanner::updateDevice(const DeviceDiscoverInfo& info)
 {
-    m_downloadPool.addJob([this, info, device] () {
+    m_downloadPool.addJob([this, info] () {
+        auto device = std::make_shared<Device>();
+
         try
         {
             obtainDeviceDetails(info, device);
@@ -364,6 +687,19 @@ void DeviceScanner::updateDevice(const DeviceDiscoverInfo& info, const std::shar
         catch (std::exception& e)
         {
             log::error(e.what());
+            device.reset();
+        }
+
+        std::lock_guard<std::mutex> lock(m_dataMutex);
+        m_pendingDownloads.erase(std::make_pair(info.deviceId, info.location));
+
+        auto iter = m_devices.find(info.deviceId);
+        if (device && device->m_udn == info.deviceId && iter != m_devices.end())
+        {
+            // the updated details replace the device
+            iter->second = device;
+            scheduleExpiry(device->m_udn, device->m_timeoutTime);
+            publishDevices();
         }
     });
 }
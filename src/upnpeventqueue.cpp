@@ -0,0 +1,131 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#include "upnpeventqueue.h"
+
+#include <algorithm>
+
+#include "utils/log.h"
+
+using namespace utils;
+
+namespace upnp
+{
+
+EventQueue::EventQueue(uint32_t threadCount, uint32_t capacity)
+: m_shardCapacity(std::max<size_t>(1, capacity / std::max<uint32_t>(1, threadCount)))
+, m_dropped(0)
+, m_coalesced(0)
+{
+    for (uint32_t i = 0; i < std::max<uint32_t>(1, threadCount); ++i)
+    {
+        m_shards.emplace_back(std::make_unique<Shard>());
+    }
+
+    for (auto& shard : m_shards)
+    {
+        auto& shardRef = *shard;
+        shard->thread = std::thread([this, &shardRef] () { dispatchThread(shardRef); });
+    }
+}
+
+EventQueue::~EventQueue()
+{
+    for (auto& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->stop = true;
+        shard->condition.notify_all();
+    }
+
+    for (auto& shard : m_shards)
+    {
+        shard->thread.join();
+    }
+}
+
+void EventQueue::push(const std::string& orderingKey, std::function<void()> event, const std::string& coalesceKey)
+{
+    auto& shard = *m_shards[std::hash<std::string>()(orderingKey) % m_shards.size()];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!coalesceKey.empty() && shard.pendingKeys.find(coalesceKey) != shard.pendingKeys.end())
+    {
+        ++m_coalesced;
+        return;
+    }
+
+    if (shard.events.size() >= m_shardCapacity)
+    {
+        if (m_dropped++ == 0)
+        {
+            log::warn("UPnP event queue is full, events are being dropped");
+        }
+        return;
+    }
+
+    if (!coalesceKey.empty())
+    {
+        shard.pendingKeys.insert(coalesceKey);
+    }
+
+    shard.events.push_back(Event { std::move(event), coalesceKey });
+    shard.condition.notify_one();
+}
+
+uint64_t EventQueue::getDroppedCount() const
+{
+    return m_dropped;
+}
+
+uint64_t EventQueue::getCoalescedCount() const
+{
+    return m_coalesced;
+}
+
+void EventQueue::dispatchThread(Shard& shard)
+{
+    for (;;)
+    {
+        Event event;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            shard.condition.wait(lock, [&] () { return shard.stop || !shard.events.empty(); });
+            if (shard.stop)
+            {
+                return;
+            }
+
+            event = std::move(shard.events.front());
+            shard.events.pop_front();
+            if (!event.coalesceKey.empty())
+            {
+                shard.pendingKeys.erase(event.coalesceKey);
+            }
+        }
+
+        try
+        {
+            event.dispatch();
+        }
+        catch (std::exception& e)
+        {
+            log::error("UPnP event handler failed: {}", e.what());
+        }
+    }
+}
+
+}
@@ -0,0 +1,79 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef UPNP_EVENT_QUEUE_H
+#define UPNP_EVENT_QUEUE_H
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <unordered_set>
+#include <condition_variable>
+
+namespace upnp
+{
+
+// Bounded queue that dispatches events on its own threads. Events with the same
+// ordering key are always dispatched by the same thread, so their order is preserved.
+// Events with a coalesce key are dropped when an event with the same key is still pending.
+class EventQueue
+{
+public:
+    EventQueue(uint32_t threadCount, uint32_t capacity);
+    EventQueue(const EventQueue&) = delete;
+    ~EventQueue();
+
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    // the event is dropped when the queue is full, pending events are not dispatched after destruction
+    void push(const std::string& orderingKey, std::function<void()> event, const std::string& coalesceKey = "");
+
+    uint64_t getDroppedCount() const;
+    uint64_t getCoalescedCount() const;
+
+private:
+    struct Event
+    {
+        std::function<void()>   dispatch;
+        std::string             coalesceKey;
+    };
+
+    struct Shard
+    {
+        std::mutex                          mutex;
+        std::condition_variable             condition;
+        std::deque<Event>                   events;
+        std::unordered_set<std::string>     pendingKeys;
+        bool                                stop = false;
+        std::thread                         thread;
+    };
+
+    void dispatchThread(Shard& shard);
+
+    std::vector<std::unique_ptr<Shard>>     m_shards;
+    size_t                                  m_shardCapacity;
+    std::atomic<uint64_t>                   m_dropped;
+    std::atomic<uint64_t>                   m_coalesced;
+};
+
+}
+
+#endif
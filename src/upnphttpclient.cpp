@@ -18,8 +18,11 @@
 
 #include <upnp.h>
 #include <cassert>
+#include <algorithm>
 #include <stdexcept>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
 
 #include "upnp/upnputils.h"
 #include "utils/format.h"
@@ -34,8 +37,20 @@ HttpClient::HttpClient(int32_t timeout)
 {
 }
 
+HttpClient::HttpClient(int32_t timeout, std::shared_ptr<HttpConnectionPool> pool)
+: m_timeout(timeout)
+, m_pool(std::move(pool))
+{
+}
+
 size_t HttpClient::getContentLength(const std::string& url)
 {
+    if (m_pool)
+    {
+        auto response = pooledRequest("HEAD", url);
+        return std::strtoul(response.headers["content-length"].c_str(), nullptr, 10);
+    }
+
 	int32_t httpStatus = 0;
     int contentLength = 0;
 
@@ -48,6 +63,11 @@ size_t HttpClient::getContentLength(const std::string& url)
 
 std::string HttpClient::getText(const std::string& url)
 {
+    if (m_pool)
+    {
+        return pooledRequest("GET", url).body;
+    }
+
     std::string data;
     int32_t httpStatus = 0;
     int contentLength = 0;
@@ -65,6 +85,12 @@ std::string HttpClient::getText(const std::string& url)
 
 std::vector<uint8_t> HttpClient::getData(const std::string& url)
 {
+    if (m_pool)
+    {
+        auto response = pooledRequest("GET", url);
+        return std::vector<uint8_t>(response.body.begin(), response.body.end());
+    }
+
     std::vector<uint8_t> data;
 
     int32_t httpStatus = 0;
@@ -82,6 +108,12 @@ std::vector<uint8_t> HttpClient::getData(const std::string& url)
 
 std::vector<uint8_t> HttpClient::getData(const std::string& url, uint64_t offset, uint64_t size)
 {
+    if (m_pool)
+    {
+        auto response = pooledRequest("GET", url, offset, size);
+        return std::vector<uint8_t>(response.body.begin(), response.body.end());
+    }
+
     std::vector<uint8_t> data;
 
     int32_t httpStatus = 0;
@@ -109,6 +141,13 @@ std::vector<uint8_t> HttpClient::getData(const std::string& url, uint64_t offset
 
 void HttpClient::getData(const std::string& url, uint8_t* pData)
 {
+    if (m_pool)
+    {
+        auto response = pooledRequest("GET", url);
+        memcpy(pData, response.body.data(), response.body.size());
+        return;
+    }
+
     int32_t httpStatus = 0;
     int contentLength = 0;
     void* pHandle = nullptr;
@@ -130,6 +169,13 @@ void HttpClient::getData(const std::string& url, uint8_t* pData)
 
 void HttpClient::getData(const std::string& url, uint8_t* pData, uint64_t offset, uint64_t size)
 {
+    if (m_pool)
+    {
+        auto response = pooledRequest("GET", url, offset, size);
+        memcpy(pData, response.body.data(), std::min<size_t>(response.body.size(), size));
+        return;
+    }
+
     int32_t httpStatus = 0;
     int contentLength = 0;
     void* pHandle = nullptr;
@@ -178,6 +224,19 @@ void HttpClient::read(void* pHandle, uint8_t* pData, size_t dataSize)
     }
 }
 
+HttpResponse HttpClient::pooledRequest(const std::string& method, const std::string& url, uint64_t offset, uint64_t size)
+{
+    std::vector<std::pair<std::string, std::string>> headers;
+    if (size > 0)
+    {
+        headers.emplace_back("RANGE", fmt::format("bytes={}-{}", offset, offset + size - 1));
+    }
+
+    auto response = m_pool->request(method, url, headers, "", std::chrono::seconds(m_timeout));
+    throwOnBadHttpStatus(url, response.status);
+    return response;
+}
+
 void HttpClient::throwOnBadHttpStatus(const std::string& url, int32_t status)
 {
     // 206 is for partial content
@@ -0,0 +1,637 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#include "upnp/upnphttpconnectionpool.h"
+#include "upnp/upnptypes.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utils/log.h"
+
+using namespace utils;
+using namespace std::chrono;
+
+namespace upnp
+{
+
+namespace
+{
+
+struct Url
+{
+    std::string host;
+    std::string port;
+    std::string path;
+};
+
+// thrown when a reused connection turned out to be closed by the peer
+struct StaleConnection : public Exception
+{
+    StaleConnection(bool sent) : Exception("Connection closed by peer"), requestSent(sent) {}
+
+    // the peer may have received and processed the request
+    bool requestSent;
+};
+
+Url parseUrl(const std::string& url)
+{
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0)
+    {
+        throw Exception("Unsupported url: {}", url);
+    }
+
+    Url result;
+    auto pathPos = url.find('/', scheme.size());
+    auto authority = url.substr(scheme.size(), pathPos == std::string::npos ? std::string::npos : pathPos - scheme.size());
+    result.path = pathPos == std::string::npos ? "/" : url.substr(pathPos);
+
+    if (authority.empty())
+    {
+        throw Exception("Invalid url: {}", url);
+    }
+
+    // ipv6 literals are enclosed in brackets: [::1]:8080
+    auto hostEnd = authority.front() == '[' ? authority.find(']') : std::string::npos;
+    auto portPos = authority.find(':', hostEnd == std::string::npos ? 0 : hostEnd);
+    result.host = authority.substr(0, portPos);
+    result.port = portPos == std::string::npos ? "80" : authority.substr(portPos + 1);
+
+    if (!result.host.empty() && result.host.front() == '[')
+    {
+        result.host = result.host.substr(1, result.host.size() - 2);
+    }
+
+    if (result.host.empty() || result.port.empty())
+    {
+        throw Exception("Invalid url: {}", url);
+    }
+
+    return result;
+}
+
+std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+std::string trim(const std::string& str)
+{
+    auto begin = str.find_first_not_of(" \t");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+
+    return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+void waitForSocket(int socket, short events, steady_clock::time_point deadline)
+{
+    for (;;)
+    {
+        auto remaining = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+        if (remaining <= 0)
+        {
+            throw Exception("Http request timed out");
+        }
+
+        pollfd pfd;
+        pfd.fd = socket;
+        pfd.events = events;
+        pfd.revents = 0;
+
+        int rc = poll(&pfd, 1, static_cast<int>(remaining));
+        if (rc > 0)
+        {
+            return;
+        }
+
+        if (rc < 0 && errno != EINTR)
+        {
+            throw Exception("Failed to wait for socket: {}", strerror(errno));
+        }
+    }
+}
+
+int connectSocket(const std::string& host, const std::string& port, steady_clock::time_point deadline)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* pAddresses = nullptr;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &pAddresses);
+    if (rc != 0)
+    {
+        throw Exception("Failed to resolve {}: {}", host, gai_strerror(rc));
+    }
+
+    std::string error = "no addresses";
+    for (auto pAddr = pAddresses; pAddr != nullptr; pAddr = pAddr->ai_next)
+    {
+        int sock = socket(pAddr->ai_family, pAddr->ai_socktype, pAddr->ai_protocol);
+        if (sock < 0)
+        {
+            error = strerror(errno);
+            continue;
+        }
+
+        fcntl(sock, F_SETFD, FD_CLOEXEC);
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+        // the requests are small, don't delay them
+        int flag = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+#ifdef SO_NOSIGPIPE
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &flag, sizeof(flag));
+#endif
+
+        try
+        {
+            if (connect(sock, pAddr->ai_addr, pAddr->ai_addrlen) != 0)
+            {
+                if (errno != EINPROGRESS)
+                {
+                    throw Exception("{}", strerror(errno));
+                }
+
+                waitForSocket(sock, POLLOUT, deadline);
+
+                int socketError = 0;
+                socklen_t length = sizeof(socketError);
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &socketError, &length);
+                if (socketError != 0)
+                {
+                    throw Exception("{}", strerror(socketError));
+                }
+            }
+
+            freeaddrinfo(pAddresses);
+            return sock;
+        }
+        catch (std::exception& e)
+        {
+            error = e.what();
+            close(sock);
+        }
+    }
+
+    freeaddrinfo(pAddresses);
+    throw Exception("Failed to connect to {}:{} ({})", host, port, error);
+}
+
+void sendAll(int socket, const std::string& data, steady_clock::time_point deadline)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        auto rc = send(socket, data.data() + sent, data.size() - sent, flags);
+        if (rc > 0)
+        {
+            sent += rc;
+        }
+        else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            waitForSocket(socket, POLLOUT, deadline);
+        }
+        else if (rc < 0 && errno != EINTR)
+        {
+            if (sent == 0 && (errno == EPIPE || errno == ECONNRESET))
+            {
+                throw StaleConnection(false);
+            }
+
+            throw Exception("Failed to send http request: {}", strerror(errno));
+        }
+    }
+}
+
+class ResponseReader
+{
+public:
+    ResponseReader(int socket, steady_clock::time_point deadline)
+    : m_socket(socket)
+    , m_deadline(deadline)
+    , m_position(0)
+    , m_receivedData(false)
+    {
+    }
+
+    std::string readLine()
+    {
+        for (;;)
+        {
+            auto end = m_buffer.find("\r\n", m_position);
+            if (end != std::string::npos)
+            {
+                auto line = m_buffer.substr(m_position, end - m_position);
+                m_position = end + 2;
+                return line;
+            }
+
+            if (!fill())
+            {
+                throw Exception("Connection closed while reading http response");
+            }
+        }
+    }
+
+    std::string read(size_t size)
+    {
+        while (m_buffer.size() - m_position < size)
+        {
+            if (!fill())
+            {
+                throw Exception("Connection closed while reading http response");
+            }
+        }
+
+        auto data = m_buffer.substr(m_position, size);
+        m_position += size;
+        return data;
+    }
+
+    std::string readUntilClosed(size_t maxSize)
+    {
+        while (fill())
+        {
+            if (m_buffer.size() - m_position > maxSize)
+            {
+                throw Exception("Http response exceeds the maximum content length of {} bytes", maxSize);
+            }
+        }
+
+        auto data = m_buffer.substr(m_position);
+        m_position = m_buffer.size();
+        return data;
+    }
+
+private:
+    bool fill()
+    {
+        if (m_position > 0)
+        {
+            m_buffer.erase(0, m_position);
+            m_position = 0;
+        }
+
+        char data[8192];
+        for (;;)
+        {
+            auto rc = recv(m_socket, data, sizeof(data), 0);
+            if (rc > 0)
+            {
+                m_buffer.append(data, rc);
+                m_receivedData = true;
+                return true;
+            }
+            else if (rc == 0)
+            {
+                if (!m_receivedData)
+                {
+                    throw StaleConnection(true);
+                }
+
+                return false;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                waitForSocket(m_socket, POLLIN, m_deadline);
+            }
+            else if (errno != EINTR)
+            {
+                if (!m_receivedData && errno == ECONNRESET)
+                {
+                    throw StaleConnection(true);
+                }
+
+                throw Exception("Failed to read http response: {}", strerror(errno));
+            }
+        }
+    }
+
+    int                         m_socket;
+    steady_clock::time_point    m_deadline;
+    std::string                 m_buffer;
+    size_t                      m_position;
+    bool                        m_receivedData;
+};
+
+std::string getHeader(const HttpResponse& response, const std::string& name)
+{
+    auto iter = response.headers.find(name);
+    return iter == response.headers.end() ? "" : iter->second;
+}
+
+// returns true if the connection can be reused for the next request
+bool readResponse(ResponseReader& reader, bool headRequest, size_t maxContentLength, HttpResponse& response)
+{
+    std::string version;
+    do
+    {
+        auto statusLine = reader.readLine();
+        auto firstSpace = statusLine.find(' ');
+        if (statusLine.compare(0, 5, "HTTP/") != 0 || firstSpace == std::string::npos)
+        {
+            throw Exception("Invalid http status line: {}", statusLine);
+        }
+
+        version = statusLine.substr(0, firstSpace);
+        response.status = std::atoi(statusLine.c_str() + firstSpace + 1);
+        response.headers.clear();
+
+        for (auto line = reader.readLine(); !line.empty(); line = reader.readLine())
+        {
+            auto colonPos = line.find(':');
+            if (colonPos != std::string::npos)
+            {
+                response.headers[toLower(trim(line.substr(0, colonPos)))] = trim(line.substr(colonPos + 1));
+            }
+        }
+    }
+    while (response.status >= 100 && response.status < 200);
+
+    auto connection = toLower(getHeader(response, "connection"));
+    bool keepAlive = version == "HTTP/1.0" ? connection == "keep-alive" : connection != "close";
+
+    if (headRequest || response.status == 204 || response.status == 304)
+    {
+        return keepAlive;
+    }
+
+    if (toLower(getHeader(response, "transfer-encoding")).find("chunked") != std::string::npos)
+    {
+        for (;;)
+        {
+            auto chunkSize = std::strtoul(reader.readLine().c_str(), nullptr, 16);
+            if (chunkSize == 0)
+            {
+                // skip the trailers
+                while (!reader.readLine().empty()) {}
+                break;
+            }
+
+            if (chunkSize > maxContentLength - response.body.size())
+            {
+                throw Exception("Http response exceeds the maximum content length of {} bytes", maxContentLength);
+            }
+
+            response.body += reader.read(chunkSize);
+            reader.readLine();
+        }
+    }
+    else if (!getHeader(response, "content-length").empty())
+    {
+        auto contentLength = std::strtoull(getHeader(response, "content-length").c_str(), nullptr, 10);
+        if (contentLength > maxContentLength)
+        {
+            throw Exception("Http response of {} bytes exceeds the maximum content length of {} bytes", contentLength, maxContentLength);
+        }
+
+        response.body = reader.read(contentLength);
+    }
+    else
+    {
+        response.body = reader.readUntilClosed(maxContentLength);
+        keepAlive = false;
+    }
+
+    return keepAlive;
+}
+
+bool isUsable(int socket)
+{
+    // an idle connection should not have anything to read, if it does the peer closed it
+    pollfd pfd;
+    pfd.fd = socket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 0;
+}
+
+}
+
+HttpConnectionPool::HttpConnectionPool(uint32_t maxConnectionsPerHost, std::chrono::seconds idleTimeout)
+: m_maxConnectionsPerHost(std::max<uint32_t>(1, maxConnectionsPerHost))
+, m_idleTimeout(idleTimeout)
+{
+}
+
+HttpConnectionPool::~HttpConnectionPool()
+{
+    closeIdleConnections();
+}
+
+HttpResponse HttpConnectionPool::request(const std::string& method, const std::string& url,
+                                         const std::vector<std::pair<std::string, std::string>>& headers,
+                                         const std::string& body, std::chrono::milliseconds timeout, size_t maxContentLength)
+{
+    auto target = parseUrl(url);
+    auto hostKey = target.host + ":" + target.port;
+    auto deadline = steady_clock::now() + timeout;
+
+    std::string request = method + " " + target.path + " HTTP/1.1\r\n";
+    request += "HOST: " + (target.host.find(':') != std::string::npos ? "[" + target.host + "]" : target.host) + ":" + target.port + "\r\n";
+    for (auto& header : headers)
+    {
+        request += header.first + ": " + header.second + "\r\n";
+    }
+
+    if (!body.empty() || method == "POST")
+    {
+        request += "CONTENT-LENGTH: " + std::to_string(body.size()) + "\r\n";
+    }
+
+    request += "\r\n";
+    request += body;
+
+    // a pooled connection can be closed by the peer at any time, the request is
+    // retried on a new connection when nothing was received on a reused one.
+    // Once the request went out the peer may have acted on it, so only
+    // idempotent requests are sent again.
+    bool idempotent = method == "GET" || method == "HEAD";
+    for (;;)
+    {
+        bool reused = false;
+        int socket = acquireConnection(target.host, target.port, duration_cast<milliseconds>(deadline - steady_clock::now()), reused);
+
+        try
+        {
+            sendAll(socket, request, deadline);
+
+            HttpResponse response;
+            ResponseReader reader(socket, deadline);
+            bool keepAlive = readResponse(reader, method == "HEAD", maxContentLength, response);
+            releaseConnection(hostKey, socket, keepAlive);
+            return response;
+        }
+        catch (StaleConnection& e)
+        {
+            releaseConnection(hostKey, socket, false);
+            if (!reused || (e.requestSent && !idempotent))
+            {
+                throw Exception("Connection closed by {} before a response was received", hostKey);
+            }
+        }
+        catch (std::exception&)
+        {
+            releaseConnection(hostKey, socket, false);
+            throw;
+        }
+    }
+}
+
+void HttpConnectionPool::closeIdleConnections()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& host : m_hosts)
+    {
+        for (auto& connection : host.second.idleConnections)
+        {
+            close(connection.socket);
+        }
+
+        host.second.idleConnections.clear();
+    }
+
+    closeExpiredConnections(steady_clock::now());
+}
+
+int HttpConnectionPool::acquireConnection(const std::string& host, const std::string& port, std::chrono::milliseconds timeout, bool& reused)
+{
+    auto deadline = steady_clock::now() + timeout;
+    auto hostKey = host + ":" + port;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto& hostInfo = m_hosts[hostKey];
+        ++hostInfo.waitingRequests;
+        bool available = m_condition.wait_until(lock, deadline, [&] () { return hostInfo.activeConnections < m_maxConnectionsPerHost; });
+        --hostInfo.waitingRequests;
+
+        if (!available)
+        {
+            throw Exception("Timed out waiting for a connection to {}", hostKey);
+        }
+
+        closeExpiredConnections(hostInfo, steady_clock::now());
+        ++hostInfo.activeConnections;
+
+        while (!hostInfo.idleConnections.empty())
+        {
+            // the most recently used connection is the least likely to be closed by the peer
+            auto connection = hostInfo.idleConnections.back();
+            hostInfo.idleConnections.pop_back();
+            if (isUsable(connection.socket))
+            {
+                reused = true;
+                return connection.socket;
+            }
+
+            close(connection.socket);
+        }
+    }
+
+    try
+    {
+        reused = false;
+        return connectSocket(host, port, deadline);
+    }
+    catch (std::exception&)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_hosts[hostKey].activeConnections;
+        m_condition.notify_all();
+        throw;
+    }
+}
+
+void HttpConnectionPool::releaseConnection(const std::string& hostKey, int socket, bool keepAlive)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& host = m_hosts[hostKey];
+    --host.activeConnections;
+
+    if (keepAlive && m_idleTimeout.count() > 0)
+    {
+        host.idleConnections.push_back(IdleConnection { socket, steady_clock::now() });
+    }
+    else
+    {
+        close(socket);
+    }
+
+    // connections to hosts that are no longer used would otherwise stay open for the life of the pool
+    closeExpiredConnections(steady_clock::now());
+    m_condition.notify_all();
+}
+
+void HttpConnectionPool::closeExpiredConnections(Host& host, steady_clock::time_point now)
+{
+    auto iter = std::remove_if(host.idleConnections.begin(), host.idleConnections.end(), [&] (const IdleConnection& connection) {
+        if (now - connection.idleSince < m_idleTimeout)
+        {
+            return false;
+        }
+
+        close(connection.socket);
+        return true;
+    });
+
+    host.idleConnections.erase(iter, host.idleConnections.end());
+}
+
+void HttpConnectionPool::closeExpiredConnections(steady_clock::time_point now)
+{
+    for (auto iter = m_hosts.begin(); iter != m_hosts.end();)
+    {
+        auto& host = iter->second;
+        closeExpiredConnections(host, now);
+
+        if (host.activeConnections == 0 && host.waitingRequests == 0 && host.idleConnections.empty())
+        {
+            iter = m_hosts.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+}
@@ -0,0 +1,643 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "upnp/upnploopbackclient.h"
+#include "upnp/upnputils.h"
+#include "upnpeventqueue.h"
+
+#include "utils/log.h"
+
+#include <thread>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+#include <upnp.h>
+
+using namespace utils;
+
+namespace upnp
+{
+
+namespace
+{
+
+template <size_t Size>
+void copyString(char (&dest)[Size], const std::string& src)
+{
+    strncpy(dest, src.c_str(), Size - 1);
+    dest[Size - 1] = '\0';
+}
+
+std::string resolveUrl(const std::string& base, const std::string& relativeUrl)
+{
+    char url[512];
+    handleUPnPResult(UpnpResolveURL(base.c_str(), relativeUrl.c_str(), url), "Failed to resolve url {} relative to {}", relativeUrl, base);
+    return url;
+}
+
+}
+
+LoopbackClient::LoopbackClient()
+: m_latency(0)
+, m_subscriptionCount(0)
+, m_deviceCount(0)
+{
+}
+
+LoopbackClient::~LoopbackClient()
+{
+    destroy();
+}
+
+void LoopbackClient::setLatency(std::chrono::microseconds latency)
+{
+    m_latency = latency.count();
+}
+
+void LoopbackClient::initialize(const char* /*interfaceName*/, int32_t /*port*/)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_eventQueue)
+        {
+            return;
+        }
+
+        // the requests are always dispatched asynchronously, like on the UPnP stack threads
+        m_eventQueue = std::make_unique<EventQueue>(std::max<uint32_t>(1, m_eventQueueSettings.threadCount), m_eventQueueSettings.capacity);
+    }
+
+    // devices that were registered before the initialization
+    announceDevices([] (const RegisteredDevice&) { return true; });
+}
+
+void LoopbackClient::destroy()
+{
+    std::unique_ptr<EventQueue> queue;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        queue = std::move(m_eventQueue);
+        m_subscriptions.clear();
+    }
+
+    // not destroyed under the lock, the pending events can still access the client
+    queue.reset();
+}
+
+void LoopbackClient::reset()
+{
+    destroy();
+    initialize();
+}
+
+void LoopbackClient::setMaxContentLength(size_t /*bytes*/)
+{
+}
+
+void LoopbackClient::setConnectionPool(const std::shared_ptr<HttpConnectionPool>& /*pool*/)
+{
+}
+
+void LoopbackClient::setActionCoalescing(const std::set<std::string>& /*actionNames*/, std::chrono::milliseconds /*resultTimeToLive*/)
+{
+}
+
+void LoopbackClient::setDocumentCache(std::chrono::seconds /*timeToLive*/, uint64_t /*maxSizeInBytes*/)
+{
+}
+
+void LoopbackClient::clearDocumentCache()
+{
+}
+
+void LoopbackClient::setEventQueueSettings(const EventQueueSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_eventQueueSettings = settings;
+}
+
+uint64_t LoopbackClient::getDroppedEventCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_eventQueue ? m_eventQueue->getDroppedCount() : 0;
+}
+
+std::string LoopbackClient::getIpAddress() const
+{
+    return "127.0.0.1";
+}
+
+int32_t LoopbackClient::getPort() const
+{
+    return 0;
+}
+
+void LoopbackClient::searchDevicesOfType(DeviceType type, int32_t /*timeout*/) const
+{
+    announceDevices([type] (const RegisteredDevice& dev) {
+        return Device::stringToDeviceType(dev.deviceType) == type;
+    });
+}
+
+void LoopbackClient::searchAllDevices(int32_t /*timeout*/) const
+{
+    announceDevices([] (const RegisteredDevice&) { return true; });
+}
+
+std::string LoopbackClient::subscribeToService(const std::string& publisherUrl, int32_t& /*timeout*/) const
+{
+    simulateLatency();
+
+    std::string subscriptionId;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        subscriptionId = fmt::format("uuid:loopback-subscription-{}", ++m_subscriptionCount);
+    }
+
+    addSubscription(subscriptionId, publisherUrl, nullptr);
+    return subscriptionId;
+}
+
+void LoopbackClient::unsubscribeFromService(const std::string& subscriptionId) const
+{
+    simulateLatency();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_subscriptions.erase(subscriptionId) == 0)
+    {
+        throw Exception(UPNP_E_INVALID_SID, "Failed to unsubscribe from service: unknown subscription id {}", subscriptionId);
+    }
+}
+
+void LoopbackClient::subscribeToService(const std::string& publisherUrl, int32_t timeout, const std::shared_ptr<IServiceSubscriber>& sub) const
+{
+    std::string subscriptionId;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        subscriptionId = fmt::format("uuid:loopback-subscription-{}", ++m_subscriptionCount);
+    }
+
+    // dispatched on the subscription id, the initial event of the subscription is
+    // queued on the same thread so it is delivered after the subscribe completion
+    std::weak_ptr<IServiceSubscriber> weakSub = sub;
+    bool queued = dispatch(subscriptionId, [this, subscriptionId, publisherUrl, timeout, weakSub] () {
+        Upnp_Event_Subscribe event;
+        memset(&event, 0, sizeof(event));
+        event.ErrCode = UPNP_E_SUCCESS;
+        event.TimeOut = timeout;
+        copyString(event.PublisherUrl, publisherUrl);
+
+        auto subscriber = weakSub.lock();
+        if (!subscriber)
+        {
+            return;
+        }
+
+        try
+        {
+            simulateLatency();
+            addSubscription(subscriptionId, publisherUrl, subscriber);
+            copyString(event.Sid, subscriptionId);
+        }
+        catch (Exception& e)
+        {
+            log::warn(e.what());
+            event.ErrCode = e.getErrorCode();
+        }
+
+        subscriber->onServiceEvent(UPNP_EVENT_SUBSCRIBE_COMPLETE, &event);
+    });
+
+    if (!queued)
+    {
+        throw Exception("Failed to subscribe to service: loopback client is not initialized");
+    }
+}
+
+void LoopbackClient::unsubscribeFromService(const std::shared_ptr<IServiceSubscriber>& sub) const
+{
+    simulateLatency();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto iter = m_subscriptions.begin(); iter != m_subscriptions.end();)
+    {
+        if (iter->second.hasSubscriber && iter->second.subscriber.lock() == sub)
+        {
+            iter = m_subscriptions.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+xml::Document LoopbackClient::sendAction(const Action& action) const
+{
+    simulateLatency();
+
+    auto endpoint = findEndpoint(m_controlUrls, action.getUrl());
+
+    Upnp_Action_Request request;
+    memset(&request, 0, sizeof(request));
+    request.ErrCode = UPNP_E_SUCCESS;
+    request.ActionRequest = action.getActionDocument();
+    copyString(request.ActionName, action.getName());
+    copyString(request.DevUDN, endpoint.udn);
+    copyString(request.ServiceID, endpoint.serviceId);
+
+    try
+    {
+        // The appropriate service should fill in the result
+        endpoint.device->ControlActionRequested(&request);
+    }
+    catch (Exception& e)
+    {
+        log::warn("Error processing request: {}", e.what());
+        request.ErrCode = e.getErrorCode();
+        copyString(request.ErrStr, e.what());
+    }
+
+    // the UPnP stack takes ownership of the result after the request
+    xml::Document result(request.ActionResult);
+    if (request.ErrCode != UPNP_E_SUCCESS)
+    {
+        throw Exception(request.ErrCode, "Failed to send action: {} ({})", action.getName(), request.ErrStr);
+    }
+
+    if (!result)
+    {
+        throw Exception(UPNP_E_BAD_RESPONSE, "No response for action {}", action.getName());
+    }
+
+    return result;
+}
+
+void LoopbackClient::sendActionAsync(Action action, const ActionResultCb& cb) const
+{
+    // the queued request shares the action instead of copying its document
+    auto request = std::make_shared<const Action>(std::move(action));
+    bool queued = dispatch(request->getUrl(), [this, request, cb] () {
+        int32_t errorCode = UPNP_E_SUCCESS;
+        std::unique_ptr<xml::Document> result;
+
+        try
+        {
+            result = std::make_unique<xml::Document>(sendAction(*request));
+        }
+        catch (Exception& e)
+        {
+            errorCode = e.getErrorCode();
+        }
+        catch (std::exception& e)
+        {
+            log::warn("Failed to send action {}: {}", request->getName(), e.what());
+            errorCode = UPNP_E_BAD_RESPONSE;
+        }
+
+        cb(errorCode, result ? std::move(*result) : xml::Document());
+    });
+
+    if (!queued)
+    {
+        throw Exception("Failed to send action {}: loopback client is not initialized", request->getName());
+    }
+}
+
+xml::Document LoopbackClient::downloadXmlDocument(const std::string& url) const
+{
+    simulateLatency();
+
+    std::string document;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_documents.find(url);
+        if (iter == m_documents.end())
+        {
+            throw Exception(UPNP_E_INVALID_URL, "Error downloading xml document from {}", url);
+        }
+
+        document = iter->second;
+    }
+
+    return xml::Document(document);
+}
+
+std::string LoopbackClient::registerDevice(LoopbackRootDevice& device, const std::string& descriptionXml, const std::map<std::string, std::string>& documents, int32_t advertiseInterval)
+{
+    xml::Document doc(descriptionXml);
+
+    RegisteredDevice registration;
+    registration.device         = &device;
+    registration.deviceType     = doc.getChildNodeValueRecursive("deviceType");
+    registration.expirationTime = static_cast<uint32_t>(std::max(0, advertiseInterval));
+
+    auto udn = device.getUniqueDeviceName();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_devices.find(udn) != m_devices.end())
+    {
+        throw Exception("Failed to register loopback device: {} is already registered", udn);
+    }
+
+    // every device gets its own host so the relative urls of the devices do not clash
+    registration.location = fmt::format("http://loopback{}/description.xml", ++m_deviceCount);
+
+    std::string base = registration.location;
+    try { base = doc.getChildNodeValueRecursive("URLBase"); } catch (std::exception&) {}
+
+    // the urls are resolved the same way as the device scanner does
+    for (xml::Element service : doc.getElementsByTagName("service"))
+    {
+        ServiceEndpoint endpoint { &device, udn, service.getChildNodeValue("serviceId") };
+        m_controlUrls[resolveUrl(base, service.getChildNodeValue("controlURL"))] = endpoint;
+        m_eventUrls[resolveUrl(base, service.getChildNodeValue("eventSubURL"))] = endpoint;
+    }
+
+    m_documents[registration.location] = descriptionXml;
+    registration.documentUrls.push_back(registration.location);
+    for (auto& document : documents)
+    {
+        auto url = resolveUrl(base, document.first);
+        m_documents[url] = document.second;
+        registration.documentUrls.push_back(url);
+    }
+
+    if (m_eventQueue)
+    {
+        DeviceDiscoverInfo info { registration.expirationTime, udn, registration.deviceType, "", "", registration.location };
+        m_eventQueue->push(udn, [this, info] () {
+            UPnPDeviceDiscoveredEvent(info);
+        });
+    }
+
+    auto location = registration.location;
+    m_devices.emplace(udn, std::move(registration));
+    return location;
+}
+
+void LoopbackClient::unregisterDevice(LoopbackRootDevice& device)
+{
+    auto udn = device.getUniqueDeviceName();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_devices.find(udn);
+    if (iter == m_devices.end() || iter->second.device != &device)
+    {
+        return;
+    }
+
+    for (auto& url : iter->second.documentUrls)
+    {
+        m_documents.erase(url);
+    }
+
+    m_devices.erase(iter);
+
+    auto eraseDevice = [&device] (auto& container) {
+        for (auto it = container.begin(); it != container.end();)
+        {
+            it = (it->second.device == &device) ? container.erase(it) : std::next(it);
+        }
+    };
+
+    eraseDevice(m_controlUrls);
+    eraseDevice(m_eventUrls);
+    eraseDevice(m_subscriptions);
+
+    if (m_eventQueue)
+    {
+        m_eventQueue->push(udn, [this, udn] () {
+            UPnPDeviceDissapearedEvent(udn);
+        });
+    }
+}
+
+void LoopbackClient::acceptSubscription(LoopbackRootDevice& device, const std::string& /*serviceId*/, const std::string& subscriptionId, const xml::Document& response)
+{
+    // the device can modify the document after the call, every subscriber parses its own copy
+    auto event = std::make_shared<const std::string>(response.toString());
+
+    std::function<void()> dispatcher;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_subscriptions.find(subscriptionId);
+        if (iter == m_subscriptions.end() || iter->second.device != &device)
+        {
+            log::warn("Failed to accept subscription: unknown subscription id {}", subscriptionId);
+            return;
+        }
+
+        dispatcher = createEventDispatcher(subscriptionId, iter->second, event);
+    }
+
+    dispatch(subscriptionId, std::move(dispatcher));
+}
+
+void LoopbackClient::notifyEvent(LoopbackRootDevice& device, const std::string& serviceId, const xml::Document& event)
+{
+    auto eventCopy = std::make_shared<const std::string>(event.toString());
+
+    std::vector<std::pair<std::string, std::function<void()>>> dispatchers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto iter = m_subscriptions.begin(); iter != m_subscriptions.end();)
+        {
+            auto& subscription = iter->second;
+            if (subscription.hasSubscriber && subscription.subscriber.expired())
+            {
+                // the subscriber was destroyed without unsubscribing
+                iter = m_subscriptions.erase(iter);
+                continue;
+            }
+
+            if (subscription.device == &device && subscription.serviceId == serviceId)
+            {
+                dispatchers.emplace_back(iter->first, createEventDispatcher(iter->first, subscription, eventCopy));
+            }
+
+            ++iter;
+        }
+    }
+
+    for (auto& dispatcher : dispatchers)
+    {
+        dispatch(dispatcher.first, std::move(dispatcher.second));
+    }
+}
+
+void LoopbackClient::simulateLatency() const
+{
+    auto latency = std::chrono::microseconds(m_latency.load());
+    if (latency.count() > 0)
+    {
+        std::this_thread::sleep_for(latency);
+    }
+}
+
+bool LoopbackClient::dispatch(const std::string& orderingKey, std::function<void()> event) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_eventQueue)
+    {
+        return false;
+    }
+
+    m_eventQueue->push(orderingKey, std::move(event));
+    return true;
+}
+
+void LoopbackClient::announceDevices(const std::function<bool(const RegisteredDevice&)>& predicate) const
+{
+    std::vector<DeviceDiscoverInfo> infos;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& dev : m_devices)
+        {
+            if (predicate(dev.second))
+            {
+                infos.push_back(DeviceDiscoverInfo { dev.second.expirationTime, dev.first, dev.second.deviceType, "", "", dev.second.location });
+            }
+        }
+    }
+
+    // the search results are reported asynchronously, like on the network
+    auto client = const_cast<LoopbackClient*>(this);
+    for (auto& info : infos)
+    {
+        dispatch(info.deviceId, [client, info] () {
+            client->simulateLatency();
+            client->UPnPDeviceDiscoveredEvent(info);
+        });
+    }
+}
+
+LoopbackClient::ServiceEndpoint LoopbackClient::findEndpoint(const std::map<std::string, ServiceEndpoint>& endpoints, const std::string& url) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = endpoints.find(url);
+    if (iter == endpoints.end())
+    {
+        throw Exception(UPNP_E_INVALID_URL, "No loopback service available at {}", url);
+    }
+
+    return iter->second;
+}
+
+void LoopbackClient::addSubscription(const std::string& subscriptionId, const std::string& publisherUrl, const std::shared_ptr<IServiceSubscriber>& sub) const
+{
+    auto endpoint = findEndpoint(m_eventUrls, publisherUrl);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_subscriptions[subscriptionId] = Subscription { endpoint.device, endpoint.serviceId, sub, sub != nullptr, 0 };
+    }
+
+    Upnp_Subscription_Request request;
+    memset(&request, 0, sizeof(request));
+    request.ServiceId = const_cast<char*>(endpoint.serviceId.c_str());
+    request.UDN = const_cast<char*>(endpoint.udn.c_str());
+    copyString(request.Sid, subscriptionId);
+
+    // the device accepts the subscription from within the signal, not under the lock
+    endpoint.device->EventSubscriptionRequested(&request);
+}
+
+std::function<void()> LoopbackClient::createEventDispatcher(const std::string& subscriptionId, Subscription& subscription, const std::shared_ptr<const std::string>& event)
+{
+    auto eventKey = subscription.eventKey++;
+    auto subscriber = subscription.subscriber;
+
+    return [this, subscriptionId, eventKey, subscriber, event] () {
+        xml::Document changedVariables(*event);
+
+        Upnp_Event upnpEvent;
+        memset(&upnpEvent, 0, sizeof(upnpEvent));
+        copyString(upnpEvent.Sid, subscriptionId);
+        upnpEvent.EventKey = eventKey;
+        upnpEvent.ChangedVariables = changedVariables;
+
+        if (auto sub = subscriber.lock())
+        {
+            sub->onServiceEvent(UPNP_EVENT_RECEIVED, &upnpEvent);
+        }
+
+        UPnPEventOccurredEvent(&upnpEvent);
+    };
+}
+
+LoopbackRootDevice::LoopbackRootDevice(LoopbackClient& client, const std::string& udn, const std::string& descriptionXml, int32_t advertiseIntervalInSeconds)
+: m_client(client)
+, m_udn(udn)
+, m_descriptionXml(descriptionXml)
+, m_advertiseInterval(advertiseIntervalInSeconds)
+{
+}
+
+LoopbackRootDevice::~LoopbackRootDevice()
+{
+    try
+    {
+        destroy();
+    }
+    catch (std::exception&) {}
+}
+
+void LoopbackRootDevice::addDocument(const std::string& relativeUrl, const std::string& xml)
+{
+    m_documents[relativeUrl] = xml;
+}
+
+std::string LoopbackRootDevice::getLocation() const
+{
+    return m_location;
+}
+
+void LoopbackRootDevice::initialize()
+{
+    if (m_location.empty())
+    {
+        m_location = m_client.registerDevice(*this, m_descriptionXml, m_documents, m_advertiseInterval);
+    }
+}
+
+void LoopbackRootDevice::destroy()
+{
+    if (!m_location.empty())
+    {
+        log::debug("Unregister loopback root device");
+        m_client.unregisterDevice(*this);
+        m_location.clear();
+    }
+}
+
+std::string LoopbackRootDevice::getUniqueDeviceName()
+{
+    return m_udn;
+}
+
+void LoopbackRootDevice::acceptSubscription(const std::string& serviceId, const std::string& subscriptionId, const xml::Document& response)
+{
+    m_client.acceptSubscription(*this, serviceId, subscriptionId, response);
+}
+
+void LoopbackRootDevice::notifyEvent(const std::string& serviceId, const xml::Document& event)
+{
+    m_client.notifyEvent(*this, serviceId, event);
+}
+
+}
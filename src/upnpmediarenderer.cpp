@@ -39,12 +39,12 @@ MediaRenderer::MediaRenderer(IClient& client)
 {
 }
 
-std::shared_ptr<Device> MediaRenderer::getDevice()
+std::shared_ptr<const Device> MediaRenderer::getDevice()
 {
     return m_device;
 }
 
-void MediaRenderer::setDevice(const std::shared_ptr<Device>& device)
+void MediaRenderer::setDevice(const std::shared_ptr<const Device>& device)
 {
     try
     {
@@ -102,7 +102,7 @@ bool MediaRenderer::supportsPlayback(const upnp::Item& item, Resource& suggested
 
 std::string MediaRenderer::getPeerConnectionManager() const
 {
-    return fmt::format("{}/{}", m_device->m_udn, m_device->m_services[ServiceType::ConnectionManager].m_id);
+    return fmt::format("{}/{}", m_device->m_udn, m_device->m_services.at(ServiceType::ConnectionManager).m_id);
 }
 
 void MediaRenderer::resetConnection()
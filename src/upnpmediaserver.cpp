@@ -50,7 +50,7 @@ MediaServer::~MediaServer()
     m_threadPool.stop();
 }
 
-void MediaServer::setDevice(const std::shared_ptr<Device>& device)
+void MediaServer::setDevice(const std::shared_ptr<const Device>& device)
 {
     try
     {
@@ -70,7 +70,7 @@ void MediaServer::setDevice(const std::shared_ptr<Device>& device)
     }
 }
 
-std::shared_ptr<Device> MediaServer::getDevice()
+std::shared_ptr<const Device> MediaServer::getDevice()
 {
     return m_device;
 }
@@ -88,7 +88,7 @@ std::string MediaServer::getPeerConnectionManager() const
 
     if (m_device->implementsService(ServiceType::ConnectionManager))
     {
-        ss << m_device->m_services[ServiceType::ConnectionManager].m_id;
+        ss << m_device->m_services.at(ServiceType::ConnectionManager).m_id;
     }
 
     return ss.str();
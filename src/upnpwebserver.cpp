@@ -18,11 +18,25 @@
 #include "upnp/upnputils.h"
 
 #include <chrono>
+#include <cctype>
+#include <cerrno>
 #include <cstring>
+#include <algorithm>
 #include <sstream>
 #include <map>
 #include <mutex>
+#include <deque>
+#include <list>
+#include <thread>
+#include <condition_variable>
 #include <memory>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <upnp.h>
 
@@ -32,6 +46,13 @@
 
 //#define DEBUG_WEBSERVER
 
+#ifndef UPNP_USING_CHUNKED
+// File length for content of unknown size. Despite the libupnp name no chunked
+// encoding is used: libupnp 1.6 omits the Content-Length header and the response
+// ends when the connection is closed.
+#define UPNP_USING_CHUNKED -3
+#endif
+
 using namespace utils;
 using namespace std::chrono;
 
@@ -41,70 +62,882 @@ namespace upnp
 namespace
 {
 
+// closes the descriptor when the last handle of the file is released
+struct FileDescriptor
+{
+    explicit FileDescriptor(int descriptor) : fd(descriptor) {}
+    FileDescriptor(const FileDescriptor&) = delete;
+    ~FileDescriptor() { ::close(fd); }
+
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int fd;
+};
+
 struct HostedFile
 {
-    std::string             filename;
-    std::vector<uint8_t>    fileContents;
-    std::string             contentType;
+    std::string                     filename;
+    std::string                     contentType;
+    // the contents are shared, multiple hosted files can alias the same buffer
+    std::shared_ptr<const uint8_t>  data;
+    // set instead of the data for files that are read from the file system
+    std::shared_ptr<const FileDescriptor> descriptor;
+    uint64_t                        size = 0;
+    time_t                          modifyTime = 0;
+    // pinned files are never evicted to stay within the memory budget
+    bool                            pinned = false;
+    steady_clock::time_point        expiryTime = steady_clock::time_point::max();
+    // updated on every request, used to evict the least recently used files first
+    mutable std::atomic<steady_clock::rep> lastAccess { 0 };
 };
 
+// The stream state of a handle is only accessed with its own mutex locked, so
+// slow providers only block the stream they are serving
 struct FileHandle
 {
-    uint64_t                                id;
+    std::mutex                              mutex;
+    uintptr_t                               index = 0;
+    uintptr_t                               generation = 0;
+    bool                                    inUse = false;
     std::string                             filename;
     size_t                                  offset = 0;
+    std::shared_ptr<const HostedFile>       file;
     std::shared_ptr<IVirtualDirCallback>    callback;
 };
 
+struct CallbackDir
+{
+    VirtualFileInfoCb   fileInfoCb;
+    RequestCb           requestCb;
+    bool                readAhead = false;
+    ReadAheadSettings   readAheadSettings;
+    bool                cacheFileInfo = false;
+};
+
+// Immutable snapshot of the hosted content. The libupnp callbacks only read the
+// current snapshot (without locking), modifications publish a modified copy.
+struct Registry
+{
+    // in memory files keyed on their full path: /virtualdir/filename
+    std::unordered_map<std::string, std::shared_ptr<const HostedFile>>  files;
+    std::unordered_map<std::string, CallbackDir>                        callbackDirs;
+    // file system backed directories: virtual dir path -> file system root
+    std::unordered_map<std::string, std::string>                        fileSystemDirs;
+};
+
+// The handles passed to libupnp encode the index of the handle in the pool in the
+// lower bits and the generation of the slot in the upper bits. The generation
+// is incremented every time a slot is released so stale handles are detected.
+const uintptr_t g_handleIndexBits = 16;
+const uintptr_t g_handleIndexMask = (uintptr_t(1) << g_handleIndexBits) - 1;
+const uintptr_t g_handleGenerationMask = UINTPTR_MAX >> g_handleIndexBits;
+
+// protects the handle pool, never held while calling into a provider
 std::mutex g_mutex;
-uint64_t g_currentRequestId = 0;
-std::map<std::string, std::vector<std::unique_ptr<HostedFile>>> g_servedFiles;
-std::map<std::string, std::pair<FileInfoCb, RequestCb>> g_virtualDirs;
-std::vector<std::unique_ptr<FileHandle>> g_openHandles;
+std::mutex g_registryMutex;
+std::shared_ptr<const Registry> g_registry = std::make_shared<Registry>();
+// a deque never moves its elements when growing, released handles are reused
+std::deque<FileHandle> g_handlePool;
+std::vector<uintptr_t> g_freeHandles;
+// maximum size of the in memory files in bytes (0 = unlimited), protected by g_registryMutex
+uint64_t g_memoryBudget = 0;
+
+std::shared_ptr<const Registry> getRegistry()
+{
+    return std::atomic_load(&g_registry);
+}
+
+template <typename Func>
+void updateRegistry(Func&& modify)
+{
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    auto registry = std::make_shared<Registry>(*getRegistry());
+    modify(*registry);
+    std::atomic_store(&g_registry, std::shared_ptr<const Registry>(std::move(registry)));
+}
+
+std::string createFilePath(const std::string& virtualDir, const std::string& filename)
+{
+    return "/" + virtualDir + "/" + filename;
+}
+
+bool isExpired(const HostedFile& file, steady_clock::time_point now)
+{
+    return file.expiryTime <= now;
+}
 
+// used to publish modified settings of a file: the contents are shared with the original,
+// the settings and the access time are copied so the eviction order is not affected
+std::shared_ptr<HostedFile> copyHostedFile(const HostedFile& file)
+{
+    auto copy = std::make_shared<HostedFile>();
+    copy->filename      = file.filename;
+    copy->contentType   = file.contentType;
+    copy->data          = file.data;
+    copy->descriptor    = file.descriptor;
+    copy->size          = file.size;
+    copy->modifyTime    = file.modifyTime;
+    copy->pinned        = file.pinned;
+    copy->expiryTime    = file.expiryTime;
+    copy->lastAccess    = file.lastAccess.load(std::memory_order_relaxed);
+    return copy;
+}
 
-FileInfoCb getInfoCallbackForFile(const std::string& uri)
+template <typename Func>
+void modifyHostedFile(Registry& registry, const std::string& virtualDir, const std::string& filename, Func&& modify)
 {
-    auto iter = g_virtualDirs.find(fileops::getPathFromFilepath(uri));
-    if (iter != g_virtualDirs.end())
+    auto iter = registry.files.find(createFilePath(virtualDir, filename));
+    if (iter == registry.files.end())
     {
-        return iter->second.first;
+        throw Exception("File is not hosted: {}/{}", virtualDir, filename);
     }
 
-    return nullptr;
+    auto file = copyHostedFile(*iter->second);
+    modify(*file);
+    iter->second = std::move(file);
 }
 
-RequestCb getRequestCallbackForFile(const std::string& uri)
+// Removes the expired files and evicts the least recently used files that are not pinned
+// until the memory budget is met. Buffers that are aliased by multiple files only count once
+// and are only released when all of the aliases are evicted. Files that are still being
+// streamed remain valid until their handle is closed.
+void enforceMemoryBudget(Registry& registry, uint64_t budget, const std::string& keepPath)
 {
-    auto iter = g_virtualDirs.find(fileops::getPathFromFilepath(uri));
-    if (iter != g_virtualDirs.end())
+    auto now = steady_clock::now();
+    for (auto iter = registry.files.begin(); iter != registry.files.end();)
+    {
+        if (isExpired(*iter->second, now))
+        {
+            iter = registry.files.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+
+    if (budget == 0)
+    {
+        return;
+    }
+
+    std::unordered_map<const uint8_t*, uint32_t> bufferRefs;
+    uint64_t usage = 0;
+    for (auto& file : registry.files)
+    {
+        if (bufferRefs[file.second->data.get()]++ == 0)
+        {
+            usage += file.second->size;
+        }
+    }
+
+    if (usage <= budget)
+    {
+        return;
+    }
+
+    std::vector<std::pair<steady_clock::rep, std::string>> candidates;
+    for (auto& file : registry.files)
     {
-        return iter->second.second;
+        if (!file.second->pinned && file.first != keepPath)
+        {
+            candidates.emplace_back(file.second->lastAccess.load(std::memory_order_relaxed), file.first);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    for (auto& candidate : candidates)
+    {
+        if (usage <= budget)
+        {
+            break;
+        }
+
+        auto iter = registry.files.find(candidate.second);
+        if (--bufferRefs[iter->second->data.get()] == 0)
+        {
+            usage -= iter->second->size;
+        }
+
+#ifdef DEBUG_WEBSERVER
+        log::debug("[Webserver] Evict: {}", candidate.second);
+#endif
+        registry.files.erase(iter);
+    }
+
+    if (usage > budget)
+    {
+        log::warn("[Webserver] Memory budget exceeded by pinned files: {} bytes in use, budget {} bytes", usage, budget);
+    }
+}
+
+VirtualFileInfoCb toVirtualFileInfoCb(FileInfoCb fileInfoCb)
+{
+    return [fileInfoCb] (const std::string& uri) {
+        auto entry = fileInfoCb(uri);
+
+        VirtualFileInfo info;
+        info.sizeInBytes    = entry.sizeInBytes;
+        info.modifyTime     = entry.modifyTime;
+        info.isDirectory    = entry.type == fileops::FileSystemEntryType::Directory;
+        return info;
+    };
+}
+
+// Cached results of the file info callbacks. The infos are grouped on the path
+// of the request uri (without the query) so invalidating a path also drops the
+// entries of its time seek requests. The least recently used paths are evicted first.
+class FileInfoCache
+{
+public:
+    // returns false on a miss, the generation has to be passed to put
+    bool get(const std::string& uri, VirtualFileInfo& info, uint64_t& generation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        generation = m_generation;
+
+        auto iter = m_entries.find(getPath(uri));
+        if (iter == m_entries.end())
+        {
+            return false;
+        }
+
+        auto infoIter = iter->second.infos.find(uri);
+        if (infoIter == iter->second.infos.end())
+        {
+            return false;
+        }
+
+        m_lru.splice(m_lru.end(), m_lru, iter->second.lruPosition);
+        info = infoIter->second;
+        return true;
+    }
+
+    void put(const std::string& uri, const VirtualFileInfo& info, uint64_t generation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (generation != m_generation)
+        {
+            // invalidated while the callback was running, the info might be stale
+            return;
+        }
+
+        auto path = getPath(uri);
+        auto iter = m_entries.find(path);
+        if (iter == m_entries.end())
+        {
+            iter = m_entries.emplace(path, Entry()).first;
+            iter->second.lruPosition = m_lru.insert(m_lru.end(), path);
+        }
+        else
+        {
+            m_lru.splice(m_lru.end(), m_lru, iter->second.lruPosition);
+        }
+
+        if (iter->second.infos.emplace(uri, info).second)
+        {
+            ++m_size;
+        }
+
+        while (m_size > s_maxSize && m_lru.size() > 1)
+        {
+            erase(m_entries.find(m_lru.front()));
+        }
+    }
+
+    void invalidate(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_generation;
+
+        auto iter = m_entries.find(path);
+        if (iter != m_entries.end())
+        {
+            erase(iter);
+        }
+    }
+
+    void invalidatePrefix(const std::string& prefix)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_generation;
+
+        for (auto iter = m_entries.begin(); iter != m_entries.end();)
+        {
+            if (iter->first.compare(0, prefix.size(), prefix) == 0)
+            {
+                iter = erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::unordered_map<std::string, VirtualFileInfo>    infos;
+        std::list<std::string>::iterator                    lruPosition;
+    };
+
+    using Entries = std::unordered_map<std::string, Entry>;
+
+    static std::string getPath(const std::string& uri)
+    {
+        return uri.substr(0, uri.find('?'));
+    }
+
+    Entries::iterator erase(Entries::iterator iter)
+    {
+        m_size -= iter->second.infos.size();
+        m_lru.erase(iter->second.lruPosition);
+        return m_entries.erase(iter);
+    }
+
+    static const size_t     s_maxSize = 4096;
+
+    std::mutex              m_mutex;
+    // incremented on every invalidation so in flight misses don't store stale infos
+    uint64_t                m_generation = 0;
+    size_t                  m_size = 0;
+    Entries                 m_entries;
+    std::list<std::string>  m_lru;
+};
+
+FileInfoCache g_fileInfoCache;
+
+VirtualFileInfo getCallbackFileInfo(const CallbackDir& dir, const std::string& uri)
+{
+    if (!dir.cacheFileInfo)
+    {
+        return dir.fileInfoCb(uri);
+    }
+
+    VirtualFileInfo info;
+    uint64_t generation;
+    if (g_fileInfoCache.get(uri, info, generation))
+    {
+        return info;
+    }
+
+    // the callback is called without holding the lock, concurrent misses for the same uri simply both call it
+    info = dir.fileInfoCb(uri);
+    g_fileInfoCache.put(uri, info, generation);
+    return info;
+}
+
+const CallbackDir* findCallbackDir(const Registry& registry, const std::string& uri)
+{
+    auto iter = registry.callbackDirs.find(fileops::getPathFromFilepath(uri));
+    if (iter != registry.callbackDirs.end())
+    {
+        return &iter->second;
     }
 
     return nullptr;
 }
 
-HostedFile& getFileFromRequest(const std::string& uri)
+std::shared_ptr<const HostedFile> findHostedFile(const Registry& registry, const std::string& uri)
 {
-    std::string dir = fileops::getPathFromFilepath(uri);
-    auto filename = fileops::getFileName(uri);
-    auto iter = g_servedFiles.find(dir);
-    if (iter == g_servedFiles.end())
+    auto iter = registry.files.find(uri);
+    if (iter == registry.files.end())
     {
-        throw Exception("Virtual directory does not exist: {}", dir);
+        return nullptr;
     }
 
-    auto fileIter = std::find_if(iter->second.begin(), iter->second.end(), [&] (const std::unique_ptr<HostedFile>& file) {
-        return file->filename == filename;
-    });
+    // expired files are removed on the next modification of the registry
+    auto now = steady_clock::now();
+    if (isExpired(*iter->second, now))
+    {
+        return nullptr;
+    }
+
+    iter->second->lastAccess.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    return iter->second;
+}
+
+const HostedFile& getFileFromRequest(const Registry& registry, const std::string& uri)
+{
+    auto file = findHostedFile(registry, uri);
+    if (!file)
+    {
+        throw Exception("File is not hosted: {}", uri);
+    }
+
+    return *file;
+}
+
+// Maps the request uri on a path on the file system if the uri belongs to a
+// file system backed virtual directory, returns an empty string otherwise
+std::string getFileSystemPath(const Registry& registry, const std::string& uri)
+{
+    if (registry.fileSystemDirs.empty())
+    {
+        return "";
+    }
+
+    // the virtual dir is looked up for every leading part of the path that ends on a separator
+    auto path = uri.substr(0, uri.find('?'));
+    for (auto pos = path.find('/', 1); pos != std::string::npos && pos + 1 < path.size(); pos = path.find('/', pos + 1))
+    {
+        auto iter = registry.fileSystemDirs.find(path.substr(0, pos));
+        if (iter != registry.fileSystemDirs.end())
+        {
+            auto relativePath = path.substr(pos);
+            if ((relativePath + "/").find("/../") != std::string::npos)
+            {
+                throw Exception("Invalid path requested: {}", uri);
+            }
+
+            return iter->second + relativePath;
+        }
+    }
+
+    return "";
+}
+
+// returns the value of a query parameter of the uri or an empty string if it is not present
+std::string getQueryParameter(const std::string& uri, const std::string& name)
+{
+    auto queryPos = uri.find('?');
+    while (queryPos != std::string::npos)
+    {
+        auto start = queryPos + 1;
+        auto end = uri.find('&', start);
+        if (uri.compare(start, name.size() + 1, name + "=") == 0)
+        {
+            start += name.size() + 1;
+            return uri.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        }
+
+        queryPos = end;
+    }
+
+    return "";
+}
+
+milliseconds parseNptTime(const std::string& time)
+{
+    try
+    {
+        size_t pos = 0;
+        double seconds = 0.0;
+        auto colonPos = time.find(':');
+        if (colonPos == std::string::npos)
+        {
+            seconds = std::stod(time, &pos);
+        }
+        else
+        {
+            auto secondColonPos = time.find(':', colonPos + 1);
+            if (secondColonPos == std::string::npos)
+            {
+                throw Exception("Invalid npt time: {}", time);
+            }
+
+            auto hours = std::stoul(time.substr(0, colonPos));
+            auto minutes = std::stoul(time.substr(colonPos + 1, secondColonPos - colonPos - 1));
+            seconds = (hours * 3600.0) + (minutes * 60.0) + std::stod(time.substr(secondColonPos + 1), &pos);
+            pos += secondColonPos + 1;
+        }
+
+        if (pos != time.size() || seconds < 0.0)
+        {
+            throw Exception("Invalid npt time: {}", time);
+        }
+
+        return milliseconds(static_cast<int64_t>(seconds * 1000.0 + 0.5));
+    }
+    catch (std::logic_error&)
+    {
+        // std::invalid_argument or std::out_of_range from the number conversion
+        throw Exception("Invalid npt time: {}", time);
+    }
+}
+
+std::string getContentTypeFromExtension(const std::string& path)
+{
+    static const std::unordered_map<std::string, std::string> contentTypes = {
+        { "mp3",  "audio/mpeg" },
+        { "flac", "audio/x-flac" },
+        { "ogg",  "audio/ogg" },
+        { "m4a",  "audio/mp4" },
+        { "aac",  "audio/aac" },
+        { "wav",  "audio/wav" },
+        { "wma",  "audio/x-ms-wma" },
+        { "m3u",  "audio/m3u" },
+        { "jpg",  "image/jpeg" },
+        { "jpeg", "image/jpeg" },
+        { "png",  "image/png" },
+        { "gif",  "image/gif" },
+        { "mp4",  "video/mp4" },
+        { "mkv",  "video/x-matroska" },
+        { "avi",  "video/x-msvideo" },
+        { "txt",  "text/plain" },
+        { "xml",  "text/xml" }
+    };
+
+    auto pos = path.rfind('.');
+    if (pos != std::string::npos)
+    {
+        auto extension = path.substr(pos + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+        auto iter = contentTypes.find(extension);
+        if (iter != contentTypes.end())
+        {
+            return iter->second;
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+// Opens the file for reading with pread. A file that is truncated while it is
+// being served ends the transfer early instead of faulting like a mapping would.
+std::shared_ptr<const HostedFile> openFile(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw Exception("Failed to open file: {}", path);
+    }
+
+    auto descriptor = std::make_shared<const FileDescriptor>(fd);
 
-    if (fileIter == iter->second.end())
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
     {
-        throw Exception("File is not hosted: {}", filename);
+        throw Exception("Not a regular file: {}", path);
     }
 
-    return (*(*fileIter).get());
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    auto file = std::make_shared<HostedFile>();
+    file->filename      = path;
+    file->contentType   = getContentTypeFromExtension(path);
+    file->size          = static_cast<uint64_t>(fileStat.st_size);
+    file->descriptor    = std::move(descriptor);
+    return file;
+}
+
+// Sits between the web server and a virtual dir callback, a worker thread keeps
+// reading ahead from the provider into a ring buffer while the web server is
+// sending the previous blocks. Seeks discard the buffered data unless the new
+// position is still inside the buffer.
+class ReadAheadStream : public IVirtualDirCallback
+{
+public:
+    ReadAheadStream(std::shared_ptr<IVirtualDirCallback> provider, const ReadAheadSettings& settings)
+    : m_provider(std::move(provider))
+    , m_blockSize(settings.blockSize)
+    , m_buffer(settings.windowSize)
+    , m_head(0)
+    , m_size(0)
+    , m_generation(0)
+    , m_active(false)
+    , m_eof(false)
+    , m_stop(false)
+    {
+        m_thread = std::thread(&ReadAheadStream::fillThread, this);
+    }
+
+    ~ReadAheadStream()
+    {
+        stopThread();
+    }
+
+    uint64_t read(uint8_t* buf, uint64_t buflen) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_active)
+        {
+            // reading ahead starts on the first read, the web server typically seeks before reading
+            m_active = true;
+            m_condition.notify_all();
+        }
+
+        m_condition.wait(lock, [this] () { return m_size > 0 || m_eof || !m_error.empty(); });
+
+        if (m_size == 0 && !m_error.empty())
+        {
+            throw Exception("Read ahead failed: {}", m_error);
+        }
+
+        uint64_t bytesRead = 0;
+        while (bytesRead < buflen && m_size > 0)
+        {
+            auto chunk = std::min<uint64_t>(std::min<uint64_t>(buflen - bytesRead, m_size), m_buffer.size() - m_head);
+            memcpy(buf + bytesRead, &m_buffer[m_head], chunk);
+
+            m_head = (m_head + chunk) % m_buffer.size();
+            m_size -= chunk;
+            bytesRead += chunk;
+        }
+
+        m_condition.notify_all();
+        return bytesRead;
+    }
+
+    void seekAbsolute(uint64_t position) override
+    {
+        seek([&] () { m_provider->seekAbsolute(position); });
+    }
+
+    void seekRelative(uint64_t offset) override
+    {
+        std::lock_guard<std::mutex> providerLock(m_providerMutex);
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // offsets are passed as unsigned values, negative offsets wrap around
+        if (static_cast<int64_t>(offset) >= 0 && offset <= m_size)
+        {
+            // the new position is still in the buffer
+            m_head = (m_head + offset) % m_buffer.size();
+            m_size -= offset;
+            m_condition.notify_all();
+            return;
+        }
+
+        // the provider is ahead of the reader by the amount of buffered data
+        m_provider->seekRelative(offset - m_size);
+        resetBuffer();
+    }
+
+    void seekFromEnd(uint64_t offset) override
+    {
+        seek([&] () { m_provider->seekFromEnd(offset); });
+    }
+
+    void close() override
+    {
+        stopThread();
+        m_provider->close();
+    }
+
+private:
+    template <typename Func>
+    void seek(Func&& providerSeek)
+    {
+        std::lock_guard<std::mutex> providerLock(m_providerMutex);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        providerSeek();
+        resetBuffer();
+    }
+
+    // Must be called with both mutexes locked
+    void resetBuffer()
+    {
+        m_head = 0;
+        m_size = 0;
+        m_eof = false;
+        m_error.clear();
+        ++m_generation;
+        m_condition.notify_all();
+    }
+
+    void stopThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_condition.notify_all();
+        }
+
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void fillThread()
+    {
+        for (;;)
+        {
+            uint64_t generation, offset, length;
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this] () {
+                    return m_stop || (m_active && !m_eof && m_error.empty() && m_size < m_buffer.size());
+                });
+
+                if (m_stop)
+                {
+                    return;
+                }
+
+                // only this thread writes in the free region of the buffer, so the
+                // provider can fill it directly without holding the buffer lock
+                offset      = (m_head + m_size) % m_buffer.size();
+                length      = offset < m_head ? m_head - offset : m_buffer.size() - offset;
+                length      = std::min<uint64_t>(std::min<uint64_t>(length, m_buffer.size() - m_size), m_blockSize);
+                generation  = m_generation;
+            }
+
+            // the provider lock is held until the data is committed, so a seek
+            // never observes a provider position that does not match the buffer
+            std::lock_guard<std::mutex> providerLock(m_providerMutex);
+            if (generation != m_generation)
+            {
+                // a seek happened in the meantime, the free region is no longer valid
+                continue;
+            }
+
+            uint64_t bytesRead = 0;
+            std::string error;
+
+            try
+            {
+                bytesRead = m_provider->read(&m_buffer[offset], length);
+            }
+            catch (std::exception& e)
+            {
+                error = e.what();
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!error.empty())
+            {
+                m_error = error;
+            }
+            else if (bytesRead == 0)
+            {
+                m_eof = true;
+            }
+            else
+            {
+                m_size += bytesRead;
+            }
+
+            m_condition.notify_all();
+        }
+    }
+
+    std::shared_ptr<IVirtualDirCallback>    m_provider;
+    const uint64_t                          m_blockSize;
+
+    std::vector<uint8_t>                    m_buffer;
+    uint64_t                                m_head;
+    uint64_t                                m_size;
+    // only modified with both mutexes locked
+    uint64_t                                m_generation;
+    bool                                    m_active;
+    bool                                    m_eof;
+    bool                                    m_stop;
+    std::string                             m_error;
+
+    std::mutex                              m_mutex;
+    std::mutex                              m_providerMutex;
+    std::condition_variable                 m_condition;
+    std::thread                             m_thread;
+};
+
+UpnpWebFileHandle acquireHandle(const std::string& filename, std::shared_ptr<const HostedFile> file, std::shared_ptr<IVirtualDirCallback> callback)
+{
+    uintptr_t index;
+    FileHandle* pHandle;
+
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (g_freeHandles.empty())
+        {
+            if (g_handlePool.size() == g_handleIndexMask)
+            {
+                throw Exception("Maximum number of open web server handles reached");
+            }
+
+            index = g_handlePool.size();
+            g_handlePool.emplace_back();
+            g_handlePool.back().index = index;
+        }
+        else
+        {
+            index = g_freeHandles.back();
+            g_freeHandles.pop_back();
+        }
+
+        pHandle = &g_handlePool[index];
+    }
+
+    std::lock_guard<std::mutex> lock(pHandle->mutex);
+    pHandle->inUse      = true;
+    pHandle->filename   = filename;
+    pHandle->offset     = 0;
+    pHandle->file       = std::move(file);
+    pHandle->callback   = std::move(callback);
+
+    // index 0 is never handed out, a valid handle is never a null pointer
+    return reinterpret_cast<UpnpWebFileHandle>((pHandle->generation << g_handleIndexBits) | (index + 1));
+}
+
+// Locks the handle, the lock does not own a mutex when the handle is invalid or stale
+std::unique_lock<std::mutex> lockHandle(UpnpWebFileHandle webHandle, FileHandle*& pHandle)
+{
+    pHandle = nullptr;
+
+    auto value      = reinterpret_cast<uintptr_t>(webHandle);
+    auto index      = value & g_handleIndexMask;
+    auto generation = value >> g_handleIndexBits;
+
+    FileHandle* pCandidate = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (index == 0 || index > g_handlePool.size())
+        {
+            return std::unique_lock<std::mutex>();
+        }
+
+        pCandidate = &g_handlePool[index - 1];
+    }
+
+    std::unique_lock<std::mutex> lock(pCandidate->mutex);
+    if (!pCandidate->inUse || pCandidate->generation != generation)
+    {
+        return std::unique_lock<std::mutex>();
+    }
+
+    pHandle = pCandidate;
+    return lock;
+}
+
+// Must be called with the handle mutex locked
+void releaseHandle(FileHandle& handle)
+{
+    handle.file.reset();
+    handle.callback.reset();
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    handle.inUse = false;
+    handle.generation = (handle.generation + 1) & g_handleGenerationMask;
+    g_freeHandles.push_back(handle.index);
+}
+
+// Closes the stream of the handle (stops the read ahead) and releases it,
+// must be called with the handle mutex locked
+int closeHandle(FileHandle& handle)
+{
+    int result = UPNP_E_SUCCESS;
+
+    try
+    {
+        if (handle.callback)
+        {
+            handle.callback->close();
+        }
+    }
+    catch (std::exception& e)
+    {
+        log::error(e.what());
+        result = UPNP_E_INVALID_ARGUMENT;
+    }
+
+    releaseHandle(handle);
+    return result;
 }
 
 UpnpWebFileHandle openCallback(const char* pFilename, UpnpOpenFileMode mode)
@@ -119,32 +952,52 @@ UpnpWebFileHandle openCallback(const char* pFilename, UpnpOpenFileMode mode)
     log::debug("[Webserver] Open: {}", pFilename);
 #endif
 
-    auto handle = std::make_unique<FileHandle>();
-    handle->filename = pFilename;
-    handle->offset = 0;
-    handle->id = ++g_currentRequestId;
-
-    std::lock_guard<std::mutex> lock(g_mutex);
-    auto iter = g_servedFiles.find(fileops::getPathFromFilepath(pFilename));
-    if (iter == g_servedFiles.end())
+    try
     {
-        auto cb = getRequestCallbackForFile(pFilename);
-        if (cb)
+        auto registry = getRegistry();
+        auto file = findHostedFile(*registry, pFilename);
+        if (file)
+        {
+            // This is an in memory file request
+            return acquireHandle(pFilename, std::move(file), nullptr);
+        }
+
+        auto path = getFileSystemPath(*registry, pFilename);
+        if (!path.empty())
         {
-            // This is a file belonging to a virtual dir with callback
-            handle->callback = cb(pFilename);
-            if (handle->callback)
+            // This is a file belonging to a file system backed virtual dir
+            return acquireHandle(pFilename, openFile(path), nullptr);
+        }
+
+        // This should be a file belonging to a virtual dir with callback
+        auto dir = findCallbackDir(*registry, pFilename);
+        if (dir)
+        {
+            auto callback = dir->requestCb(pFilename);
+            if (callback)
             {
-                g_openHandles.push_back(std::move(handle));
-                return g_openHandles.back().get();
+                auto timeSeek = getQueryParameter(pFilename, "npt");
+                if (!timeSeek.empty())
+                {
+                    auto range = parseTimeSeekRange(timeSeek);
+                    if (!callback->seekToTime(range.start, range.end))
+                    {
+                        log::warn("[Webserver] Time seek not supported, serving from the start: {}", pFilename);
+                    }
+                }
+
+                if (dir->readAhead)
+                {
+                    callback = std::make_shared<ReadAheadStream>(std::move(callback), dir->readAheadSettings);
+                }
+
+                return acquireHandle(pFilename, nullptr, std::move(callback));
             }
         }
     }
-    else
+    catch (std::exception& e)
     {
-        // This is an in memory file request (file in g_serverdFiles)
-        g_openHandles.push_back(std::move(handle));
-        return g_openHandles.back().get();
+        log::error(e.what());
     }
 
     return nullptr;
@@ -163,28 +1016,52 @@ int getInfoCallback(const char* pFilename, File_Info* pInfo)
 
     try
     {
-        auto cb = getInfoCallbackForFile(pFilename);
-        if (!cb)
+        auto registry = getRegistry();
+        auto dir = findCallbackDir(*registry, pFilename);
+        auto path = getFileSystemPath(*registry, pFilename);
+        if (!path.empty())
         {
-            // not a callback dir, check if in memory
+            struct stat fileStat;
+            if (stat(path.c_str(), &fileStat) != 0)
+            {
+                throw Exception("Failed to stat file: {}", path);
+            }
 
-            std::lock_guard<std::mutex> lock(g_mutex);
-            auto& file = getFileFromRequest(pFilename);
+            pInfo->file_length = fileStat.st_size;
+            pInfo->last_modified = fileStat.st_mtime;
+            pInfo->is_directory = S_ISDIR(fileStat.st_mode) ? 1 : 0;
+            pInfo->is_readable = access(path.c_str(), R_OK) == 0 ? 1 : 0;
+            pInfo->content_type = ixmlCloneDOMString(getContentTypeFromExtension(path).c_str());
+        }
+        else if (!dir)
+        {
+            // not a callback dir, check if in memory
+            auto& file = getFileFromRequest(*registry, pFilename);
 
-            pInfo->file_length = file.fileContents.size();
-            pInfo->last_modified = system_clock::to_time_t(system_clock::now());
+            pInfo->file_length = file.size;
+            pInfo->last_modified = file.modifyTime;
             pInfo->is_directory = 0;
             pInfo->is_readable = 1;
             pInfo->content_type = ixmlCloneDOMString(file.contentType.c_str());
         }
         else
         {
-            auto info = cb(pFilename);
-            pInfo->file_length = info.sizeInBytes;
+            auto info = getCallbackFileInfo(*dir, pFilename);
+            // the size of the file does not apply to a time seek request
+            if (info.unknownSize || !getQueryParameter(pFilename, "npt").empty())
+            {
+                // served until the connection is closed, not chunked (see UPNP_USING_CHUNKED)
+                pInfo->file_length = UPNP_USING_CHUNKED;
+            }
+            else
+            {
+                pInfo->file_length = info.sizeInBytes;
+            }
+
             pInfo->last_modified = info.modifyTime;
-            pInfo->is_directory = info.type == fileops::FileSystemEntryType::Directory ? 1 : 0;
+            pInfo->is_directory = info.isDirectory ? 1 : 0;
             pInfo->is_readable = 1;
-            pInfo->content_type = ixmlCloneDOMString("application/octet-stream");
+            pInfo->content_type = ixmlCloneDOMString(info.contentType.c_str());
         }
     }
     catch (std::exception& e)
@@ -198,15 +1075,14 @@ int getInfoCallback(const char* pFilename, File_Info* pInfo)
 
 int readCallback(UpnpWebFileHandle fileHandle, char* buf, size_t buflen)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
-
     if (buf == nullptr)
     {
         return UPNP_E_INVALID_ARGUMENT;
     }
 
-    FileHandle* pHandle = reinterpret_cast<FileHandle*>(fileHandle);
-    if (pHandle->filename.empty())
+    FileHandle* pHandle;
+    auto lock = lockHandle(fileHandle, pHandle);
+    if (!pHandle)
     {
         return UPNP_E_INVALID_ARGUMENT;
     }
@@ -223,21 +1099,41 @@ int readCallback(UpnpWebFileHandle fileHandle, char* buf, size_t buflen)
         }
         else
         {
-            auto& file = getFileFromRequest(pHandle->filename);
-            if (pHandle->offset == file.fileContents.size())
+            auto& file = *pHandle->file;
+            if (pHandle->offset == file.size)
             {
                 return 0;
             }
 
-            assert(pHandle->offset < file.fileContents.size());
-            if (pHandle->offset + buflen > file.fileContents.size())
+            assert(pHandle->offset < file.size);
+            if (pHandle->offset + buflen > file.size)
             {
-                buflen = file.fileContents.size() - pHandle->offset;
+                buflen = file.size - pHandle->offset;
             }
 
-            memcpy(buf, &file.fileContents[pHandle->offset], buflen);
-            pHandle->offset += buflen;
+            if (file.descriptor)
+            {
+                // a short read when the file was truncated after it was opened
+                ssize_t bytesRead;
+                do
+                {
+                    bytesRead = pread(file.descriptor->fd, buf, buflen, static_cast<off_t>(pHandle->offset));
+                }
+                while (bytesRead < 0 && errno == EINTR);
+
+                if (bytesRead < 0)
+                {
+                    throw Exception("Failed to read file {}: {}", file.filename, strerror(errno));
+                }
+
+                buflen = static_cast<size_t>(bytesRead);
+            }
+            else
+            {
+                memcpy(buf, file.data.get() + pHandle->offset, buflen);
+            }
 
+            pHandle->offset += buflen;
             return static_cast<int>(buflen);
         }
     }
@@ -256,8 +1152,12 @@ int writeCallback(UpnpWebFileHandle /*fileHandle*/, char* /*buf*/, size_t /*bufl
 
 int seekCallback(UpnpWebFileHandle fileHandle, off_t offset, int origin)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    FileHandle* pHandle = reinterpret_cast<FileHandle*>(fileHandle);
+    FileHandle* pHandle;
+    auto lock = lockHandle(fileHandle, pHandle);
+    if (!pHandle)
+    {
+        return UPNP_E_INVALID_ARGUMENT;
+    }
 
 #ifdef DEBUG_WEBSERVER
     log::debug("[Webserver] Seek: {} (offset: {} mode: {})", pHandle->filename, offset, origin);
@@ -286,7 +1186,7 @@ int seekCallback(UpnpWebFileHandle fileHandle, off_t offset, int origin)
         }
         else
         {
-            auto& file = getFileFromRequest(pHandle->filename);
+            auto& file = *pHandle->file;
 
             int64_t newPosition;
             switch (origin)
@@ -295,7 +1195,7 @@ int seekCallback(UpnpWebFileHandle fileHandle, off_t offset, int origin)
                     newPosition = pHandle->offset + offset;
                     break;
                 case SEEK_END:
-                    newPosition = file.fileContents.size() - offset;
+                    newPosition = file.size - offset;
                     break;
                 case SEEK_SET:
                     newPosition = offset;
@@ -304,7 +1204,7 @@ int seekCallback(UpnpWebFileHandle fileHandle, off_t offset, int origin)
                     return UPNP_E_INVALID_ARGUMENT;
             }
 
-            if (newPosition < 0 || static_cast<uint64_t>(newPosition) >= file.fileContents.size())
+            if (newPosition < 0 || static_cast<uint64_t>(newPosition) >= file.size)
             {
                 return UPNP_E_INVALID_ARGUMENT;
             }
@@ -323,34 +1223,43 @@ int seekCallback(UpnpWebFileHandle fileHandle, off_t offset, int origin)
 
 int closeCallback(UpnpWebFileHandle fileHandle)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    FileHandle* pHandle = reinterpret_cast<FileHandle*>(fileHandle);
+    FileHandle* pHandle;
+    auto lock = lockHandle(fileHandle, pHandle);
+    if (!pHandle)
+    {
+        return UPNP_E_INVALID_ARGUMENT;
+    }
 
 #ifdef DEBUG_WEBSERVER
     log::debug("[Webserver] Close: {}", pHandle->filename);
 #endif
 
-    try
-    {
-        if (pHandle->callback)
-        {
-            pHandle->callback->close();
-            pHandle->callback.reset();
-        }
+    return closeHandle(*pHandle);
+}
 
-        g_openHandles.erase(std::remove_if(g_openHandles.begin(), g_openHandles.end(), [&] (const std::unique_ptr<FileHandle>& file) {
-            return file->id == pHandle->id;
-        }), g_openHandles.end());
+}
 
-        return UPNP_E_SUCCESS;
+TimeSeekRange parseTimeSeekRange(const std::string& range)
+{
+    auto value = range.compare(0, 4, "npt=") == 0 ? range.substr(4) : range;
+    auto separatorPos = value.find('-');
+    if (separatorPos == std::string::npos || separatorPos == 0)
+    {
+        throw Exception("Invalid time seek range: {}", range);
     }
-    catch (std::exception& e)
+
+    TimeSeekRange result;
+    result.start = parseNptTime(value.substr(0, separatorPos));
+    if (separatorPos + 1 < value.size())
     {
-        log::error(e.what());
-        return UPNP_E_INVALID_ARGUMENT;
+        result.end = parseNptTime(value.substr(separatorPos + 1));
+        if (result.end <= result.start)
+        {
+            throw Exception("Invalid time seek range: {}", range);
+        }
     }
-}
 
+    return result;
 }
 
 WebServer::WebServer(const std::string& webRoot)
@@ -372,6 +1281,7 @@ WebServer::WebServer(const std::string& webRoot)
 WebServer::~WebServer()
 {
     clearFiles();
+    setMemoryBudget(0);
 
     UpnpRemoveAllVirtualDirs();
     UpnpSetWebServerRootDir(nullptr);
@@ -384,64 +1294,247 @@ std::string WebServer::getWebRootUrl()
 
 void WebServer::addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::string& data)
 {
-    auto file = std::make_unique<HostedFile>();
-    file->filename       = filename;
-    file->contentType    = contentType;
-    file->fileContents.resize(data.size());
-    std::copy(data.begin(), data.end(), file->fileContents.begin());
-
-    std::lock_guard<std::mutex> lock(g_mutex);
-    g_servedFiles["/" + virtualDir].push_back(std::move(file));
+    addFile(virtualDir, filename, contentType, std::make_shared<std::vector<uint8_t>>(data.begin(), data.end()));
 }
 
 void WebServer::addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::vector<uint8_t>& data)
 {
-    auto file = std::make_unique<HostedFile>();
-    file->filename       = filename;
-    file->contentType    = contentType;
-    file->fileContents   = data;
+    addFile(virtualDir, filename, contentType, std::make_shared<std::vector<uint8_t>>(data));
+}
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    g_servedFiles["/" + virtualDir].push_back(std::move(file));
+void WebServer::addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::shared_ptr<const std::vector<uint8_t>>& data)
+{
+    if (!data)
+    {
+        throw Exception("No data provided for file: {}", filename);
+    }
+
+    // the aliasing constructor keeps the vector alive as long as the data pointer is in use
+    addFile(virtualDir, filename, contentType, std::shared_ptr<const uint8_t>(data, data->data()), data->size());
+}
+
+void WebServer::addFile(const std::string& virtualDir, const std::string& filename, const std::string& contentType, const std::shared_ptr<const uint8_t>& data, uint64_t size)
+{
+    if (!data && size != 0)
+    {
+        throw Exception("No data provided for file: {}", filename);
+    }
+
+    auto file = std::make_shared<HostedFile>();
+    file->filename      = filename;
+    file->contentType   = contentType;
+    file->data          = data;
+    file->size          = size;
+    file->modifyTime    = system_clock::to_time_t(system_clock::now());
+    file->lastAccess    = steady_clock::now().time_since_epoch().count();
+
+    auto path = createFilePath(virtualDir, filename);
+    updateRegistry([&] (Registry& registry) {
+        registry.files[path] = std::move(file);
+        enforceMemoryBudget(registry, g_memoryBudget, path);
+    });
 }
 
 void WebServer::removeFile(const std::string& virtualDir, const std::string& filename)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    auto& files = g_servedFiles["/" + virtualDir];
-    files.erase(std::remove_if(files.begin(), files.end(), [&] (const std::unique_ptr<HostedFile>& file) {
-        return file->filename == filename;
-    }), files.end());
+    updateRegistry([&] (Registry& registry) {
+        registry.files.erase(createFilePath(virtualDir, filename));
+    });
+}
+
+void WebServer::setMemoryBudget(uint64_t bytes)
+{
+    updateRegistry([&] (Registry& registry) {
+        g_memoryBudget = bytes;
+        enforceMemoryBudget(registry, g_memoryBudget, "");
+    });
+}
+
+void WebServer::setFileTimeToLive(const std::string& virtualDir, const std::string& filename, std::chrono::seconds timeToLive)
+{
+    updateRegistry([&] (Registry& registry) {
+        modifyHostedFile(registry, virtualDir, filename, [&] (HostedFile& file) {
+            file.expiryTime = timeToLive.count() > 0 ? steady_clock::now() + timeToLive : steady_clock::time_point::max();
+        });
+    });
+}
+
+void WebServer::pinFile(const std::string& virtualDir, const std::string& filename, bool pinned)
+{
+    updateRegistry([&] (Registry& registry) {
+        modifyHostedFile(registry, virtualDir, filename, [&] (HostedFile& file) {
+            file.pinned = pinned;
+        });
+
+        if (!pinned)
+        {
+            enforceMemoryBudget(registry, g_memoryBudget, "");
+        }
+    });
+}
+
+void WebServer::purgeExpiredFiles()
+{
+    updateRegistry([] (Registry& registry) {
+        enforceMemoryBudget(registry, g_memoryBudget, "");
+    });
+}
+
+uint64_t WebServer::getMemoryUsage()
+{
+    auto registry = getRegistry();
+
+    std::unordered_map<const uint8_t*, uint64_t> buffers;
+    for (auto& file : registry->files)
+    {
+        buffers.emplace(file.second->data.get(), file.second->size);
+    }
+
+    uint64_t usage = 0;
+    for (auto& buffer : buffers)
+    {
+        usage += buffer.second;
+    }
+
+    return usage;
 }
 
 void WebServer::clearFiles()
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    g_servedFiles.clear();
-    g_virtualDirs.clear();
-    g_openHandles.clear();
+    updateRegistry([] (Registry& registry) {
+        registry = Registry();
+    });
+
+    g_fileInfoCache.invalidatePrefix("");
+
+    size_t handleCount;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        handleCount = g_handlePool.size();
+    }
+
+    // close the handles that are still open like libupnp would, the slots remain available for reuse
+    for (size_t i = 0; i < handleCount; ++i)
+    {
+        FileHandle* pHandle;
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            pHandle = &g_handlePool[i];
+        }
+
+        std::lock_guard<std::mutex> lock(pHandle->mutex);
+        if (pHandle->inUse)
+        {
+            closeHandle(*pHandle);
+        }
+    }
 }
 
 void WebServer::addVirtualDirectory(const std::string& virtualDirName)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
     handleUPnPResult(UpnpAddVirtualDir(virtualDirName.c_str()), "Failed to add virtual directory to webserver");
-    g_servedFiles.emplace("/" + virtualDirName, std::vector<std::unique_ptr<HostedFile>>());
 }
 
 void WebServer::addVirtualDirectory(const std::string& virtualDirName, FileInfoCb fileinfoCb, RequestCb requestCb)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
+    addVirtualDirectory(virtualDirName, toVirtualFileInfoCb(fileinfoCb), requestCb);
+}
+
+void WebServer::addVirtualDirectory(const std::string& virtualDirName, FileInfoCb fileinfoCb, RequestCb requestCb, const ReadAheadSettings& readAhead)
+{
+    addVirtualDirectory(virtualDirName, toVirtualFileInfoCb(fileinfoCb), requestCb, readAhead);
+}
+
+void WebServer::addVirtualDirectory(const std::string& virtualDirName, VirtualFileInfoCb fileinfoCb, RequestCb requestCb)
+{
+    CallbackDir dir;
+    dir.fileInfoCb  = fileinfoCb;
+    dir.requestCb   = requestCb;
+
+    handleUPnPResult(UpnpAddVirtualDir(virtualDirName.c_str()), "Failed to add virtual directory to webserver");
+    updateRegistry([&] (Registry& registry) {
+        registry.callbackDirs.emplace("/" + virtualDirName, dir);
+    });
+}
+
+void WebServer::addVirtualDirectory(const std::string& virtualDirName, VirtualFileInfoCb fileinfoCb, RequestCb requestCb, const ReadAheadSettings& readAhead)
+{
+    if (readAhead.blockSize == 0 || readAhead.windowSize < readAhead.blockSize)
+    {
+        throw Exception("Invalid read ahead settings: block size {} window size {}", readAhead.blockSize, readAhead.windowSize);
+    }
+
+    CallbackDir dir;
+    dir.fileInfoCb          = fileinfoCb;
+    dir.requestCb           = requestCb;
+    dir.readAhead           = true;
+    dir.readAheadSettings   = readAhead;
+
     handleUPnPResult(UpnpAddVirtualDir(virtualDirName.c_str()), "Failed to add virtual directory to webserver");
-    g_virtualDirs.emplace("/" + virtualDirName, std::make_pair(fileinfoCb, requestCb));
+    updateRegistry([&] (Registry& registry) {
+        registry.callbackDirs.emplace("/" + virtualDirName, dir);
+    });
+}
+
+void WebServer::addVirtualDirectory(const std::string& virtualDirName, const std::string& rootPath)
+{
+    handleUPnPResult(UpnpAddVirtualDir(virtualDirName.c_str()), "Failed to add virtual directory to webserver");
+    updateRegistry([&] (Registry& registry) {
+        registry.fileSystemDirs.emplace("/" + virtualDirName, rootPath);
+    });
 }
 
 void WebServer::removeVirtualDirectory(const std::string& virtualDirName)
 {
-    std::lock_guard<std::mutex> lock(g_mutex);
     UpnpRemoveVirtualDir(virtualDirName.c_str());
-    g_servedFiles.erase("/" + virtualDirName);
-    g_virtualDirs.erase("/" + virtualDirName);
+
+    auto prefix = createFilePath(virtualDirName, "");
+    updateRegistry([&] (Registry& registry) {
+        for (auto iter = registry.files.begin(); iter != registry.files.end();)
+        {
+            if (iter->first.compare(0, prefix.size(), prefix) == 0)
+            {
+                iter = registry.files.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+
+        registry.callbackDirs.erase("/" + virtualDirName);
+        registry.fileSystemDirs.erase("/" + virtualDirName);
+    });
+
+    g_fileInfoCache.invalidatePrefix(prefix);
+}
+
+void WebServer::setFileInfoCaching(const std::string& virtualDirName, bool enabled)
+{
+    updateRegistry([&] (Registry& registry) {
+        auto iter = registry.callbackDirs.find("/" + virtualDirName);
+        if (iter == registry.callbackDirs.end())
+        {
+            throw Exception("Not a virtual directory with callbacks: {}", virtualDirName);
+        }
+
+        iter->second.cacheFileInfo = enabled;
+    });
+
+    if (!enabled)
+    {
+        invalidateFileInfo(virtualDirName);
+    }
+}
+
+void WebServer::invalidateFileInfo(const std::string& virtualDirName, const std::string& filename)
+{
+    g_fileInfoCache.invalidate(createFilePath(virtualDirName, filename));
+}
+
+void WebServer::invalidateFileInfo(const std::string& virtualDirName)
+{
+    g_fileInfoCache.invalidatePrefix(createFilePath(virtualDirName, ""));
 }
 
 }
@@ -0,0 +1,150 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "gtest/gtest.h"
+
+#include "upnp/upnpxml.h"
+#include "upnpdevicedescription.h"
+
+using namespace testing;
+
+namespace upnp
+{
+namespace test
+{
+
+TEST(DeviceDescriptionTest, ParseRootDevice)
+{
+    xml::Document doc(
+        "<?xml version=\"1.0\"?>"
+        "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+        "  <specVersion><major>1</major><minor>0</minor></specVersion>"
+        "  <device>"
+        "    <deviceType>urn:schemas-upnp-org:device:MediaServer:1</deviceType>"
+        "    <friendlyName>Server</friendlyName>"
+        "    <UDN>uuid:server</UDN>"
+        "    <serviceList>"
+        "      <service>"
+        "        <serviceType>urn:schemas-upnp-org:service:ContentDirectory:1</serviceType>"
+        "        <serviceId>urn:upnp-org:serviceId:ContentDirectory</serviceId>"
+        "        <SCPDURL>/ContentDirectory/scpd.xml</SCPDURL>"
+        "        <controlURL>/ContentDirectory/control</controlURL>"
+        "        <eventSubURL>/ContentDirectory/event</eventSubURL>"
+        "      </service>"
+        "    </serviceList>"
+        "  </device>"
+        "</root>");
+
+    auto description = parseDeviceDescription(doc);
+    EXPECT_EQ("urn:schemas-upnp-org:device:MediaServer:1", description.deviceType);
+    EXPECT_EQ("Server", description.friendlyName);
+    EXPECT_EQ("uuid:server", description.udn);
+    EXPECT_TRUE(description.baseURL.empty());
+    EXPECT_TRUE(description.presentationURL.empty());
+
+    ASSERT_EQ(1u, description.services.size());
+    EXPECT_EQ("urn:schemas-upnp-org:service:ContentDirectory:1", description.services[0].type);
+    EXPECT_EQ("urn:upnp-org:serviceId:ContentDirectory", description.services[0].id);
+    EXPECT_EQ("/ContentDirectory/scpd.xml", description.services[0].scpdURL);
+    EXPECT_EQ("/ContentDirectory/control", description.services[0].controlURL);
+    EXPECT_EQ("/ContentDirectory/event", description.services[0].eventSubURL);
+}
+
+TEST(DeviceDescriptionTest, ParseUrlBaseAndPresentationUrl)
+{
+    xml::Document doc(
+        "<?xml version=\"1.0\"?>"
+        "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+        "  <specVersion><major>1</major><minor>0</minor></specVersion>"
+        "  <URLBase>http://192.168.1.10:49152/</URLBase>"
+        "  <device>"
+        "    <deviceType>urn:schemas-upnp-org:device:MediaRenderer:1</deviceType>"
+        "    <friendlyName>Renderer</friendlyName>"
+        "    <UDN>uuid:renderer</UDN>"
+        "    <presentationURL>/index.html</presentationURL>"
+        "  </device>"
+        "</root>");
+
+    auto description = parseDeviceDescription(doc);
+    EXPECT_EQ("http://192.168.1.10:49152/", description.baseURL);
+    EXPECT_EQ("/index.html", description.presentationURL);
+    EXPECT_TRUE(description.services.empty());
+}
+
+TEST(DeviceDescriptionTest, ParseEmbeddedDevices)
+{
+    xml::Document doc(
+        "<?xml version=\"1.0\"?>"
+        "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+        "  <specVersion><major>1</major><minor>0</minor></specVersion>"
+        "  <device>"
+        "    <deviceType>urn:schemas-upnp-org:device:MediaRenderer:1</deviceType>"
+        "    <friendlyName>Root</friendlyName>"
+        "    <UDN>uuid:root</UDN>"
+        "    <serviceList>"
+        "      <service>"
+        "        <serviceType>urn:schemas-upnp-org:service:RenderingControl:1</serviceType>"
+        "        <controlURL>/root/RenderingControl</controlURL>"
+        "      </service>"
+        "    </serviceList>"
+        "    <deviceList>"
+        "      <device>"
+        "        <deviceType>urn:schemas-upnp-org:device:Embedded:1</deviceType>"
+        "        <friendlyName>Embedded</friendlyName>"
+        "        <UDN>uuid:embedded</UDN>"
+        "        <presentationURL>/embedded.html</presentationURL>"
+        "        <serviceList>"
+        "          <service>"
+        "            <serviceType>urn:schemas-upnp-org:service:ConnectionManager:1</serviceType>"
+        "            <controlURL>/embedded/ConnectionManager</controlURL>"
+        "          </service>"
+        "          <service>"
+        "            <serviceType>urn:schemas-upnp-org:service:RenderingControl:1</serviceType>"
+        "            <controlURL>/embedded/RenderingControl</controlURL>"
+        "          </service>"
+        "        </serviceList>"
+        "      </device>"
+        "    </deviceList>"
+        "  </device>"
+        "</root>");
+
+    auto description = parseDeviceDescription(doc);
+
+    // the embedded device does not override the fields of the root device
+    EXPECT_EQ("urn:schemas-upnp-org:device:MediaRenderer:1", description.deviceType);
+    EXPECT_EQ("Root", description.friendlyName);
+    EXPECT_EQ("uuid:root", description.udn);
+    EXPECT_TRUE(description.presentationURL.empty());
+
+    // the services of the root device come first
+    ASSERT_EQ(3u, description.services.size());
+    EXPECT_EQ("/root/RenderingControl", description.services[0].controlURL);
+    EXPECT_EQ("/embedded/ConnectionManager", description.services[1].controlURL);
+    EXPECT_EQ("/embedded/RenderingControl", description.services[2].controlURL);
+}
+
+TEST(DeviceDescriptionTest, ParseDescriptionWithoutDevice)
+{
+    xml::Document doc("<?xml version=\"1.0\"?><root xmlns=\"urn:schemas-upnp-org:device-1-0\"></root>");
+
+    auto description = parseDeviceDescription(doc);
+    EXPECT_TRUE(description.deviceType.empty());
+    EXPECT_TRUE(description.services.empty());
+}
+
+}
+}
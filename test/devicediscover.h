@@ -56,7 +56,7 @@ public:
         m_Scanner.stop();
     }
 
-    void deviceDiscovered(std::shared_ptr<upnp::Device> dev)
+    void deviceDiscovered(std::shared_ptr<const upnp::Device> dev)
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
         if (dev->m_FriendlyName == m_DeviceName)
@@ -66,7 +66,7 @@ public:
         }
     }
 
-    std::shared_ptr<Device> getDevice()
+    std::shared_ptr<const Device> getDevice()
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
         return m_Device;
@@ -75,7 +75,7 @@ public:
 private:
     upnp::DeviceScanner             m_Scanner;
     std::string                     m_DeviceName;
-    std::shared_ptr<Device>         m_Device;
+    std::shared_ptr<const Device>   m_Device;
 
     std::condition_variable         m_Condition;
     std::mutex                      m_Mutex;
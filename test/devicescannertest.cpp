@@ -0,0 +1,310 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "utils/log.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+
+#include "testutils.h"
+#include "upnpclientmock.h"
+
+#include "upnp/upnpdevicescanner.h"
+#include "upnp/upnpxmlutils.h"
+
+using namespace utils;
+using namespace testing;
+using namespace std::chrono;
+
+namespace upnp
+{
+namespace test
+{
+
+static const std::string g_udn = "uuid:scanner-renderer";
+static const std::string g_location = "http://192.168.1.10:49152/description.xml";
+static const std::string g_cacheFile = "devicescannertest.cache";
+static const std::string g_description =
+"<?xml version=\"1.0\"?>"
+"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+"  <specVersion><major>1</major><minor>0</minor></specVersion>"
+"  <device>"
+"    <deviceType>urn:schemas-upnp-org:device:MediaRenderer:1</deviceType>"
+"    <friendlyName>Renderer</friendlyName>"
+"    <UDN>uuid:scanner-renderer</UDN>"
+"    <serviceList>"
+"      <service>"
+"        <serviceType>urn:schemas-upnp-org:service:RenderingControl:1</serviceType>"
+"        <serviceId>urn:upnp-org:serviceId:RenderingControl</serviceId>"
+"        <SCPDURL>/RenderingControl/scpd.xml</SCPDURL>"
+"        <controlURL>/RenderingControl/control</controlURL>"
+"        <eventSubURL>/RenderingControl/event</eventSubURL>"
+"      </service>"
+"      <service>"
+"        <serviceType>urn:schemas-upnp-org:service:ConnectionManager:1</serviceType>"
+"        <serviceId>urn:upnp-org:serviceId:ConnectionManager</serviceId>"
+"        <SCPDURL>/ConnectionManager/scpd.xml</SCPDURL>"
+"        <controlURL>/ConnectionManager/control</controlURL>"
+"        <eventSubURL>/ConnectionManager/event</eventSubURL>"
+"      </service>"
+"    </serviceList>"
+"  </device>"
+"</root>";
+
+static xml::Document downloadDescription(const std::string& /*url*/)
+{
+    return xml::Document(g_description);
+}
+
+class DeviceScannerTest : public Test
+{
+protected:
+    DeviceScannerTest()
+    : scanner(client, DeviceType::MediaRenderer)
+    {
+    }
+
+    void TearDown()
+    {
+        scanner.stop();
+        scanner.DeviceDiscoveredEvent.disconnect(this);
+        scanner.DeviceDissapearedEvent.disconnect(this);
+        std::remove(g_cacheFile.c_str());
+    }
+
+    DeviceDiscoverInfo createDiscoverInfo(uint32_t expirationTime = 1800)
+    {
+        DeviceDiscoverInfo info;
+        info.expirationTime = expirationTime;
+        info.deviceId       = g_udn;
+        info.deviceType     = Device::deviceTypeToString(DeviceType::MediaRenderer);
+        info.location       = g_location;
+        return info;
+    }
+
+    std::string createCacheEntry(const std::string& udn, const std::string& timeout)
+    {
+        return "<device udn=\"" + udn + "\" type=\"urn:schemas-upnp-org:device:MediaRenderer:1\" friendlyName=\"Renderer\""
+               " baseURL=\"\" relURL=\"\" presURL=\"\" location=\"" + g_location + "\" timeout=\"" + timeout + "\">"
+               "<service type=\"urn:schemas-upnp-org:service:RenderingControl:1\" id=\"urn:upnp-org:serviceId:RenderingControl\""
+               " scpdURL=\"http://192.168.1.10:49152/RenderingControl/scpd.xml\" controlURL=\"http://192.168.1.10:49152/RenderingControl/control\""
+               " eventSubURL=\"http://192.168.1.10:49152/RenderingControl/event\"/>"
+               "</device>";
+    }
+
+    void writeCacheEntries(const std::string& entries)
+    {
+        std::ofstream file(g_cacheFile, std::ios::trunc);
+        file << "<devices>" << entries << "</devices>";
+    }
+
+    void writeCacheFile(const std::string& timeout)
+    {
+        writeCacheEntries(createCacheEntry(g_udn, timeout));
+    }
+
+    std::string getValidTimeout()
+    {
+        return std::to_string(static_cast<int64_t>(system_clock::to_time_t(system_clock::now() + hours(1))));
+    }
+
+    bool isVerified(const std::string& udn)
+    {
+        auto snapshot = scanner.getDeviceSnapshot();
+        auto iter = snapshot->devices.find(udn);
+        return iter != snapshot->devices.end() && iter->second->m_verified;
+    }
+
+    StrictMock<ClientMock>  client;
+    DeviceScanner           scanner;
+};
+
+TEST_F(DeviceScannerTest, RemoveDeviceAtDeadline)
+{
+    std::promise<std::string> disappeared;
+    scanner.DeviceDissapearedEvent.connect([&] (std::shared_ptr<const Device> device) { disappeared.set_value(device->m_udn); }, this);
+
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillOnce(Invoke(downloadDescription));
+    scanner.start();
+
+    auto start = steady_clock::now();
+    client.UPnPDeviceDiscoveredEvent(createDiscoverInfo(1));
+    ASSERT_TRUE(waitFor([&] () { return scanner.getDeviceCount() == 1; }));
+
+    auto future = disappeared.get_future();
+    ASSERT_EQ(std::future_status::ready, future.wait_for(seconds(5)));
+    EXPECT_EQ(g_udn, future.get());
+    EXPECT_GE(steady_clock::now() - start, milliseconds(900));
+    EXPECT_EQ(0u, scanner.getDeviceCount());
+}
+
+TEST_F(DeviceScannerTest, DownloadDescriptionOnceForConcurrentDiscoveries)
+{
+    std::atomic<int> discoveredCount(0);
+    scanner.DeviceDiscoveredEvent.connect([&] (std::shared_ptr<const Device>) { ++discoveredCount; }, this);
+
+    // the slow download keeps the description in flight while the other advertisements arrive
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillOnce(Invoke([] (const std::string& url) {
+        std::this_thread::sleep_for(milliseconds(200));
+        return downloadDescription(url);
+    }));
+
+    scanner.start();
+    for (int i = 0; i < 5; ++i)
+    {
+        client.UPnPDeviceDiscoveredEvent(createDiscoverInfo());
+    }
+
+    ASSERT_TRUE(waitFor([&] () { return scanner.getDeviceCount() == 1; }));
+
+    // an advertisement of the known device does not download the description again
+    client.UPnPDeviceDiscoveredEvent(createDiscoverInfo());
+    EXPECT_EQ(1, discoveredCount);
+    EXPECT_EQ(1u, scanner.getDeviceCount());
+}
+
+TEST_F(DeviceScannerTest, RenewalOfVerifiedDeviceIsNotPublished)
+{
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillOnce(Invoke(downloadDescription));
+    scanner.start();
+
+    client.UPnPDeviceDiscoveredEvent(createDiscoverInfo(1));
+    ASSERT_TRUE(waitFor([&] () { return scanner.getDeviceCount() == 1; }));
+    auto snapshot = scanner.getDeviceSnapshot();
+
+    // the renewals move the deadline without publishing a new snapshot
+    for (int i = 0; i < 3; ++i)
+    {
+        client.UPnPDeviceDiscoveredEvent(createDiscoverInfo(1800));
+    }
+
+    EXPECT_EQ(snapshot, scanner.getDeviceSnapshot());
+
+    // the device outlives its original deadline of one second
+    std::this_thread::sleep_for(milliseconds(1500));
+    EXPECT_EQ(1u, scanner.getDeviceCount());
+}
+
+TEST_F(DeviceScannerTest, SaveAndLoadCache)
+{
+    {
+        DeviceScanner cachingScanner(client, DeviceType::MediaRenderer);
+        cachingScanner.setCacheFile(g_cacheFile);
+
+        EXPECT_CALL(client, downloadXmlDocument(g_location)).WillOnce(Invoke(downloadDescription));
+        cachingScanner.start();
+        client.UPnPDeviceDiscoveredEvent(createDiscoverInfo());
+        ASSERT_TRUE(waitFor([&] () { return cachingScanner.getDeviceCount() == 1; }));
+        cachingScanner.stop();
+    }
+
+    Mock::VerifyAndClearExpectations(&client);
+
+    std::shared_ptr<const Device> cachedDevice;
+    scanner.DeviceDiscoveredEvent.connect([&] (std::shared_ptr<const Device> device) { cachedDevice = device; }, this);
+    scanner.setCacheFile(g_cacheFile);
+
+    // the cached device is revalidated in the background
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillOnce(Invoke(downloadDescription));
+    scanner.start();
+
+    ASSERT_TRUE(cachedDevice != nullptr);
+    EXPECT_EQ(g_udn, cachedDevice->m_udn);
+    EXPECT_EQ("Renderer", cachedDevice->m_friendlyName);
+    EXPECT_EQ(g_location, cachedDevice->m_location);
+    EXPECT_FALSE(cachedDevice->m_verified);
+    ASSERT_TRUE(cachedDevice->implementsService(ServiceType::RenderingControl));
+    EXPECT_EQ("http://192.168.1.10:49152/RenderingControl/control", cachedDevice->m_services.at(ServiceType::RenderingControl).m_controlURL);
+
+    EXPECT_TRUE(waitFor([&] () { return isVerified(g_udn); }));
+    // the revalidated details are published as a new instance
+    EXPECT_NE(cachedDevice, scanner.getDevice(g_udn));
+    EXPECT_TRUE(scanner.getDevice(g_udn)->implementsService(ServiceType::ConnectionManager));
+}
+
+TEST_F(DeviceScannerTest, CorruptCacheFile)
+{
+    {
+        std::ofstream file(g_cacheFile, std::ios::trunc);
+        file << "<devices><device udn=\"";
+    }
+
+    scanner.setCacheFile(g_cacheFile);
+    scanner.start();
+    EXPECT_EQ(0u, scanner.getDeviceCount());
+}
+
+TEST_F(DeviceScannerTest, SkipInvalidCacheEntry)
+{
+    // the invalid entry is skipped, the valid entry after it is still loaded
+    writeCacheEntries(createCacheEntry("uuid:invalid", "invalid") + createCacheEntry(g_udn, getValidTimeout()));
+
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillRepeatedly(Invoke(downloadDescription));
+    scanner.setCacheFile(g_cacheFile);
+    scanner.start();
+
+    EXPECT_EQ(1u, scanner.getDeviceCount());
+    EXPECT_EQ(g_udn, scanner.getDevice(g_udn)->m_udn);
+}
+
+TEST_F(DeviceScannerTest, SkipExpiredCacheEntry)
+{
+    writeCacheFile(std::to_string(static_cast<int64_t>(system_clock::to_time_t(system_clock::now() - hours(1)))));
+
+    scanner.setCacheFile(g_cacheFile);
+    scanner.start();
+    EXPECT_EQ(0u, scanner.getDeviceCount());
+}
+
+TEST_F(DeviceScannerTest, RevalidationRemovesUnavailableDevice)
+{
+    writeCacheFile(getValidTimeout());
+
+    std::promise<std::string> disappeared;
+    scanner.DeviceDissapearedEvent.connect([&] (std::shared_ptr<const Device> device) { disappeared.set_value(device->m_udn); }, this);
+    scanner.setCacheFile(g_cacheFile);
+
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillOnce(Throw(Exception("Connection refused")));
+    scanner.start();
+
+    auto future = disappeared.get_future();
+    ASSERT_EQ(std::future_status::ready, future.wait_for(seconds(5)));
+    EXPECT_EQ(g_udn, future.get());
+    EXPECT_EQ(0u, scanner.getDeviceCount());
+}
+
+TEST_F(DeviceScannerTest, AdvertisementVerifiesCachedDevice)
+{
+    writeCacheFile(getValidTimeout());
+    scanner.setCacheFile(g_cacheFile);
+
+    // the revalidation is not needed anymore when the device advertises itself
+    EXPECT_CALL(client, downloadXmlDocument(g_location)).WillRepeatedly(Invoke(downloadDescription));
+    scanner.start();
+    client.UPnPDeviceDiscoveredEvent(createDiscoverInfo());
+
+    EXPECT_TRUE(isVerified(g_udn));
+    EXPECT_EQ(1u, scanner.getDeviceCount());
+}
+
+}
+}
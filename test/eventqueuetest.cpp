@@ -0,0 +1,172 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "testutils.h"
+#include "upnpeventqueue.h"
+
+using namespace testing;
+using namespace std::chrono;
+
+namespace upnp
+{
+namespace test
+{
+
+class EventQueueTest : public Test
+{
+protected:
+    // occupies the dispatch thread of the key until the gate is opened
+    void blockDispatchThread(EventQueue& queue, const std::string& orderingKey)
+    {
+        std::promise<void> started;
+        auto gate = m_gate.get_future().share();
+        queue.push(orderingKey, [&started, gate] () {
+            started.set_value();
+            gate.wait();
+        });
+
+        started.get_future().wait();
+    }
+
+    void openGate()
+    {
+        m_gate.set_value();
+    }
+
+    std::atomic<uint32_t>   dispatched { 0 };
+
+private:
+    std::promise<void>      m_gate;
+};
+
+TEST_F(EventQueueTest, PreserveOrderPerKey)
+{
+    std::mutex mutex;
+    std::map<std::string, std::vector<int>> received;
+
+    EventQueue queue(4, 1000);
+    for (int i = 0; i < 100; ++i)
+    {
+        for (auto& key : { "device1", "device2", "device3" })
+        {
+            queue.push(key, [&, key, i] () {
+                std::lock_guard<std::mutex> lock(mutex);
+                received[key].push_back(i);
+                ++dispatched;
+            });
+        }
+    }
+
+    ASSERT_TRUE(waitFor([&] () { return dispatched == 300; }));
+    for (auto& keyEvents : received)
+    {
+        ASSERT_EQ(100u, keyEvents.second.size());
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(i, keyEvents.second[i]);
+        }
+    }
+
+    EXPECT_EQ(0u, queue.getDroppedCount());
+}
+
+TEST_F(EventQueueTest, DropEventsWhenFull)
+{
+    EventQueue queue(1, 2);
+    blockDispatchThread(queue, "device");
+
+    queue.push("device", [&] () { ++dispatched; });
+    queue.push("device", [&] () { ++dispatched; });
+    EXPECT_EQ(0u, queue.getDroppedCount());
+
+    queue.push("device", [&] () { ++dispatched; });
+    queue.push("device", [&] () { ++dispatched; });
+    EXPECT_EQ(2u, queue.getDroppedCount());
+
+    openGate();
+    ASSERT_TRUE(waitFor([&] () { return dispatched == 2; }));
+
+    // there is room again once the pending events are dispatched
+    queue.push("device", [&] () { ++dispatched; });
+    EXPECT_TRUE(waitFor([&] () { return dispatched == 3; }));
+    EXPECT_EQ(2u, queue.getDroppedCount());
+}
+
+TEST_F(EventQueueTest, CoalescePendingEvents)
+{
+    EventQueue queue(1, 10);
+    blockDispatchThread(queue, "device");
+
+    queue.push("device", [&] () { ++dispatched; }, "volume");
+    queue.push("device", [&] () { ++dispatched; }, "volume");
+    queue.push("device", [&] () { ++dispatched; }, "mute");
+    queue.push("device", [&] () { ++dispatched; });
+    EXPECT_EQ(1u, queue.getCoalescedCount());
+
+    openGate();
+    ASSERT_TRUE(waitFor([&] () { return dispatched == 3; }));
+
+    // the key is no longer pending after the event was dispatched
+    queue.push("device", [&] () { ++dispatched; }, "volume");
+    EXPECT_TRUE(waitFor([&] () { return dispatched == 4; }));
+    EXPECT_EQ(1u, queue.getCoalescedCount());
+    EXPECT_EQ(0u, queue.getDroppedCount());
+}
+
+TEST_F(EventQueueTest, DestroyWithPendingEvents)
+{
+    auto queue = std::make_unique<EventQueue>(2, 100);
+    blockDispatchThread(*queue, "device");
+
+    for (int i = 0; i < 10; ++i)
+    {
+        queue->push("device", [&] () { ++dispatched; });
+    }
+
+    // the running event completes after the destruction started
+    std::thread opener([this] () {
+        std::this_thread::sleep_for(milliseconds(100));
+        openGate();
+    });
+
+    queue.reset();
+    opener.join();
+
+    // the pending events are dropped
+    EXPECT_EQ(0u, dispatched);
+}
+
+TEST_F(EventQueueTest, HandlerExceptionDoesNotStopDispatching)
+{
+    EventQueue queue(1, 10);
+    queue.push("device", [] () { throw std::runtime_error("handler failure"); });
+    queue.push("device", [&] () { ++dispatched; });
+
+    EXPECT_TRUE(waitFor([&] () { return dispatched == 1; }));
+}
+
+}
+}
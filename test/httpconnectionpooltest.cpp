@@ -0,0 +1,100 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "gtest/gtest.h"
+
+#include "httptestserver.h"
+
+#include "upnp/upnphttpconnectionpool.h"
+#include "upnp/upnptypes.h"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace upnp
+{
+namespace test
+{
+
+static const std::string g_okResponse = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK";
+
+TEST(HttpConnectionPoolTest, Request)
+{
+    HttpTestServer server({ g_okResponse });
+    HttpConnectionPool pool;
+
+    auto response = pool.request("GET", server.getUrl(), {}, "", 5s);
+    EXPECT_EQ(200, response.status);
+    EXPECT_EQ("OK", response.body);
+    EXPECT_EQ("2", response.headers["content-length"]);
+}
+
+TEST(HttpConnectionPoolTest, RejectOversizedContentLength)
+{
+    HttpTestServer server({ "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nHello world" });
+    HttpConnectionPool pool;
+
+    EXPECT_THROW(pool.request("GET", server.getUrl(), {}, "", 5s, 10), Exception);
+}
+
+TEST(HttpConnectionPoolTest, RejectOversizedChunkedBody)
+{
+    HttpTestServer server({ "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nHello \r\n5\r\nworld\r\n0\r\n\r\n" });
+    HttpConnectionPool pool;
+
+    EXPECT_THROW(pool.request("GET", server.getUrl(), {}, "", 5s, 10), Exception);
+}
+
+TEST(HttpConnectionPoolTest, RejectOversizedBodyWithoutLength)
+{
+    HttpTestServer server({ "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n" + std::string(100000, 'x'), "" });
+    HttpConnectionPool pool;
+
+    EXPECT_THROW(pool.request("GET", server.getUrl(), {}, "", 5s, 1000), Exception);
+}
+
+TEST(HttpConnectionPoolTest, BodyWithinLimit)
+{
+    HttpTestServer server({ "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nHello world" });
+    HttpConnectionPool pool;
+
+    EXPECT_EQ("Hello world", pool.request("GET", server.getUrl(), {}, "", 5s, 11).body);
+}
+
+TEST(HttpConnectionPoolTest, RetryGetOnStaleConnection)
+{
+    // the second request on the kept alive connection is dropped by the server
+    HttpTestServer server({ g_okResponse, "", g_okResponse });
+    HttpConnectionPool pool;
+
+    EXPECT_EQ("OK", pool.request("GET", server.getUrl(), {}, "", 5s).body);
+    EXPECT_EQ("OK", pool.request("GET", server.getUrl(), {}, "", 5s).body);
+    EXPECT_EQ(3u, server.getRequestCount());
+}
+
+TEST(HttpConnectionPoolTest, DontResendPostOnStaleConnection)
+{
+    HttpTestServer server({ g_okResponse, "", g_okResponse });
+    HttpConnectionPool pool;
+
+    EXPECT_EQ("OK", pool.request("POST", server.getUrl(), {}, "<action/>", 5s).body);
+    EXPECT_THROW(pool.request("POST", server.getUrl(), {}, "<action/>", 5s), Exception);
+    EXPECT_EQ(2u, server.getRequestCount());
+}
+
+}
+}
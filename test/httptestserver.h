@@ -0,0 +1,192 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#ifndef UPNP_HTTP_TEST_SERVER_H
+#define UPNP_HTTP_TEST_SERVER_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace upnp
+{
+namespace test
+{
+
+// Answers every request with the next scripted response, an empty response
+// closes the connection without answering. Every connection is served on its
+// own thread, the responses are sent after the configured delay.
+class HttpTestServer
+{
+public:
+    HttpTestServer(std::deque<std::string> responses, std::chrono::milliseconds delay = std::chrono::milliseconds(0))
+    : m_delay(delay)
+    , m_responses(std::move(responses))
+    , m_requestCount(0)
+    {
+        m_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        listen(m_socket, 8);
+
+        socklen_t length = sizeof(addr);
+        getsockname(m_socket, reinterpret_cast<sockaddr*>(&addr), &length);
+        m_url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/control";
+
+        m_thread = std::thread([this] () { run(); });
+    }
+
+    ~HttpTestServer()
+    {
+        shutdown(m_socket, SHUT_RDWR);
+        close(m_socket);
+        m_thread.join();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto client : m_clients)
+            {
+                shutdown(client, SHUT_RDWR);
+            }
+        }
+
+        for (auto& thread : m_clientThreads)
+        {
+            thread.join();
+        }
+
+        for (auto client : m_clients)
+        {
+            close(client);
+        }
+    }
+
+    const std::string& getUrl() const
+    {
+        return m_url;
+    }
+
+    uint32_t getRequestCount() const
+    {
+        return m_requestCount;
+    }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            int client = accept(m_socket, nullptr, nullptr);
+            if (client < 0)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_clients.push_back(client);
+            m_clientThreads.emplace_back([this, client] () { serve(client); });
+        }
+    }
+
+    void serve(int client)
+    {
+        while (readRequest(client))
+        {
+            ++m_requestCount;
+
+            std::string response;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_responses.empty())
+                {
+                    response = m_responses.front();
+                    m_responses.pop_front();
+                }
+            }
+
+            if (response.empty())
+            {
+                break;
+            }
+
+            std::this_thread::sleep_for(m_delay);
+            send(client, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+
+        // the socket is closed by the destructor, after the thread is joined
+        shutdown(client, SHUT_RDWR);
+    }
+
+    bool readRequest(int client)
+    {
+        std::string request;
+        while (request.find("\r\n\r\n") == std::string::npos)
+        {
+            char data[1024];
+            auto rc = recv(client, data, sizeof(data), 0);
+            if (rc <= 0)
+            {
+                return false;
+            }
+
+            request.append(data, rc);
+        }
+
+        auto lengthPos = request.find("CONTENT-LENGTH: ");
+        auto bodySize = lengthPos == std::string::npos ? 0 : std::stoul(request.substr(lengthPos + 16));
+        while (request.size() - (request.find("\r\n\r\n") + 4) < bodySize)
+        {
+            char data[1024];
+            auto rc = recv(client, data, sizeof(data), 0);
+            if (rc <= 0)
+            {
+                return false;
+            }
+
+            request.append(data, rc);
+        }
+
+        return true;
+    }
+
+    int                         m_socket;
+    std::string                 m_url;
+    std::chrono::milliseconds   m_delay;
+    std::thread                 m_thread;
+    std::mutex                  m_mutex;
+    std::deque<std::string>     m_responses;
+    std::vector<int>            m_clients;
+    std::vector<std::thread>    m_clientThreads;
+    std::atomic<uint32_t>       m_requestCount;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,250 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "utils/log.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include <mutex>
+#include <vector>
+#include <condition_variable>
+
+#include "upnp/upnploopbackclient.h"
+#include "upnp/upnpactionresponse.h"
+#include "upnp/upnputils.h"
+#include "testxmls.h"
+
+using namespace utils;
+using namespace testing;
+using namespace std::placeholders;
+
+namespace upnp
+{
+namespace test
+{
+
+static const std::string g_udn = "uuid:loopback-renderer";
+static const std::string g_serviceId = "urn:upnp-org:serviceId:RenderingControl";
+static const std::string g_description =
+"<?xml version=\"1.0\"?>"
+"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+"  <specVersion><major>1</major><minor>0</minor></specVersion>"
+"  <device>"
+"    <deviceType>urn:schemas-upnp-org:device:MediaRenderer:1</deviceType>"
+"    <friendlyName>Loopback renderer</friendlyName>"
+"    <UDN>uuid:loopback-renderer</UDN>"
+"    <serviceList>"
+"      <service>"
+"        <serviceType>urn:schemas-upnp-org:service:RenderingControl:1</serviceType>"
+"        <serviceId>urn:upnp-org:serviceId:RenderingControl</serviceId>"
+"        <SCPDURL>/RenderingControl/scpd.xml</SCPDURL>"
+"        <controlURL>/RenderingControl/control</controlURL>"
+"        <eventSubURL>/RenderingControl/event</eventSubURL>"
+"      </service>"
+"    </serviceList>"
+"  </device>"
+"</root>";
+
+class Subscriber : public IServiceSubscriber
+{
+public:
+    void onServiceEvent(Upnp_EventType eventType, void* pEvent) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (eventType == UPNP_EVENT_SUBSCRIBE_COMPLETE)
+        {
+            sid = reinterpret_cast<Upnp_Event_Subscribe*>(pEvent)->Sid;
+        }
+        else if (eventType == UPNP_EVENT_RECEIVED)
+        {
+            events.push_back(xml::Document(reinterpret_cast<Upnp_Event*>(pEvent)->ChangedVariables, xml::Document::NoOwnership).toString());
+        }
+
+        condition.notify_all();
+    }
+
+    std::string getSubscriptionId() override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sid;
+    }
+
+    bool waitForEvents(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return condition.wait_for(lock, std::chrono::seconds(5), [&] () { return events.size() >= count; });
+    }
+
+    std::mutex                  mutex;
+    std::condition_variable     condition;
+    std::string                 sid;
+    std::vector<std::string>    events;
+};
+
+class LoopbackClientTest : public Test
+{
+public:
+    LoopbackClientTest()
+    : device(client, g_udn, g_description, 1800)
+    {
+        device.addDocument("/RenderingControl/scpd.xml", testxmls::renderingServiceDescription);
+        device.ControlActionRequested.connect(std::bind(&LoopbackClientTest::onAction, this, _1), this);
+        device.EventSubscriptionRequested.connect(std::bind(&LoopbackClientTest::onSubscription, this, _1), this);
+
+        client.initialize();
+        device.initialize();
+    }
+
+    ~LoopbackClientTest()
+    {
+        device.destroy();
+        client.destroy();
+    }
+
+    void onAction(Upnp_Action_Request* request)
+    {
+        if (std::string(request->ActionName) != "GetVolume")
+        {
+            throw Exception(401, "Invalid action");
+        }
+
+        ActionResponse response(request->ActionName, ServiceType::RenderingControl);
+        response.addArgument("CurrentVolume", "35");
+        request->ActionResult = ixmlParseBuffer(response.getActionDocument().toString().c_str());
+    }
+
+    void onSubscription(Upnp_Subscription_Request* request)
+    {
+        EXPECT_EQ(g_udn, request->UDN);
+        EXPECT_EQ(g_serviceId, request->ServiceId);
+        device.acceptSubscription(request->ServiceId, request->Sid, xml::Document("<initial/>"));
+    }
+
+    std::string getUrl(const std::string& relativeUrl)
+    {
+        char url[512];
+        handleUPnPResult(UpnpResolveURL(device.getLocation().c_str(), relativeUrl.c_str(), url));
+        return url;
+    }
+
+    LoopbackClient          client;
+    LoopbackRootDevice      device;
+};
+
+TEST_F(LoopbackClientTest, downloadDescriptions)
+{
+    auto doc = client.downloadXmlDocument(device.getLocation());
+    EXPECT_EQ(g_udn, doc.getChildNodeValueRecursive("UDN"));
+
+    auto scpd = client.downloadXmlDocument(getUrl("/RenderingControl/scpd.xml"));
+    EXPECT_FALSE(xml::utils::getActionsFromDescription(scpd).empty());
+
+    EXPECT_THROW(client.downloadXmlDocument(getUrl("/unknown.xml")), Exception);
+}
+
+TEST_F(LoopbackClientTest, discoverDevice)
+{
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<DeviceDiscoverInfo> infos;
+
+    client.UPnPDeviceDiscoveredEvent.connect([&] (const DeviceDiscoverInfo& info) {
+        std::lock_guard<std::mutex> lock(mutex);
+        infos.push_back(info);
+        condition.notify_all();
+    }, this);
+
+    client.searchDevicesOfType(DeviceType::MediaServer, 5);
+    client.searchDevicesOfType(DeviceType::MediaRenderer, 5);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(condition.wait_for(lock, std::chrono::seconds(5), [&] () { return !infos.empty(); }));
+    EXPECT_EQ(1u, infos.size());
+    EXPECT_EQ(g_udn, infos[0].deviceId);
+    EXPECT_EQ(device.getLocation(), infos[0].location);
+    EXPECT_EQ(1800u, infos[0].expirationTime);
+    lock.unlock();
+
+    client.UPnPDeviceDiscoveredEvent.disconnect(this);
+}
+
+TEST_F(LoopbackClientTest, sendAction)
+{
+    Action action("GetVolume", getUrl("/RenderingControl/control"), ServiceType::RenderingControl);
+    action.addArgument("InstanceID", "0");
+    action.addArgument("Channel", "Master");
+
+    auto result = client.sendAction(action);
+    EXPECT_EQ("35", result.getChildNodeValueRecursive("CurrentVolume"));
+
+    Action invalidAction("SetVolume", getUrl("/RenderingControl/control"), ServiceType::RenderingControl);
+    try
+    {
+        client.sendAction(invalidAction);
+        FAIL() << "Expected exception";
+    }
+    catch (Exception& e)
+    {
+        EXPECT_EQ(401, e.getErrorCode());
+    }
+}
+
+TEST_F(LoopbackClientTest, sendActionAsync)
+{
+    client.setLatency(std::chrono::milliseconds(1));
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::string> volumes;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        Action action("GetVolume", getUrl("/RenderingControl/control"), ServiceType::RenderingControl);
+        client.sendActionAsync(std::move(action), [&] (int32_t errorCode, xml::Document result) {
+            EXPECT_EQ(UPNP_E_SUCCESS, errorCode);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            volumes.push_back(result.getChildNodeValueRecursive("CurrentVolume"));
+            condition.notify_all();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(condition.wait_for(lock, std::chrono::seconds(5), [&] () { return volumes.size() == 3; }));
+    EXPECT_THAT(volumes, Each(Eq("35")));
+}
+
+TEST_F(LoopbackClientTest, subscribeAndReceiveEvents)
+{
+    auto subscriber = std::make_shared<Subscriber>();
+    client.subscribeToService(getUrl("/RenderingControl/event"), 1800, subscriber);
+    ASSERT_TRUE(subscriber->waitForEvents(1));
+    EXPECT_FALSE(subscriber->getSubscriptionId().empty());
+
+    device.notifyEvent(g_serviceId, xml::Document("<change/>"));
+    ASSERT_TRUE(subscriber->waitForEvents(2));
+    EXPECT_THAT(subscriber->events[0], HasSubstr("initial"));
+    EXPECT_THAT(subscriber->events[1], HasSubstr("change"));
+
+    client.unsubscribeFromService(subscriber);
+    device.notifyEvent(g_serviceId, xml::Document("<change/>"));
+    client.destroy();
+    EXPECT_EQ(2u, subscriber->events.size());
+}
+
+}
+}
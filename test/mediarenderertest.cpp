@@ -58,8 +58,8 @@ protected:
     {
     }
 
-    MediaRenderer               m_Renderer;    
-    std::shared_ptr<Device>     m_Device;
+    MediaRenderer                    m_Renderer;
+    std::shared_ptr<const Device>    m_Device;
 };
 
 TEST_F(MediaRendererTest, DiscoveredServices)
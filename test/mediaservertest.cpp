@@ -68,8 +68,8 @@ protected:
     {
     }
 
-    MediaServer                 m_Server;
-    std::shared_ptr<Device>     m_Device;
+    MediaServer                      m_Server;
+    std::shared_ptr<const Device>    m_Device;
 };
 
 TEST_F(MediaServerTest, DiscoveredServices)
@@ -65,22 +65,22 @@ public:
         return m_Client;
     }
 
-    std::shared_ptr<Device> getServer()
+    std::shared_ptr<const Device> getServer()
     {
         return m_ServerDevice;
     }
 
-    std::shared_ptr<Device> getRenderer()
+    std::shared_ptr<const Device> getRenderer()
     {
         return m_RendererDevice;
     }
 
 private:
-    Client                      m_Client;
-    DeviceDiscover              m_ServerDiscoverer;
-    DeviceDiscover              m_RendererDiscoverer;
-    std::shared_ptr<Device>     m_ServerDevice;
-    std::shared_ptr<Device>     m_RendererDevice;
+    Client                           m_Client;
+    DeviceDiscover                   m_ServerDiscoverer;
+    DeviceDiscover                   m_RendererDiscoverer;
+    std::shared_ptr<const Device>    m_ServerDevice;
+    std::shared_ptr<const Device>    m_RendererDevice;
 };
 
 }
@@ -17,8 +17,13 @@
 #ifndef UPNP_TEST_UTILS_H
 #define UPNP_TEST_UTILS_H
 
+#include <chrono>
+#include <thread>
+#include <sstream>
+
 #include "upnp/upnpitem.h"
 #include "upnp/upnptypes.h"
+#include "upnp/upnpxml.h"
 
 #include "utils/numericoperations.h"
 
@@ -98,6 +103,24 @@ inline xml::Document generateBrowseResponse(const std::vector<upnp::Item>& conta
                                                                              std::make_pair("UpdateID", "1")});
 }
 
+// polls the predicate until it is satisfied, returns false when the timeout expires
+template <typename Predicate>
+bool waitFor(Predicate pred, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (pred())
+        {
+            return true;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return pred();
+}
+
 }
 
 #endif
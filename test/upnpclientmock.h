@@ -34,6 +34,9 @@ public:
     MOCK_METHOD2(initialize, void(const char*, int32_t));
     MOCK_METHOD0(destroy, void());
     MOCK_METHOD0(reset, void());
+    MOCK_METHOD1(setMaxContentLength, void(size_t));
+    MOCK_METHOD1(setEventQueueSettings, void(const EventQueueSettings&));
+    MOCK_CONST_METHOD0(getDroppedEventCount, uint64_t());
     
     MOCK_CONST_METHOD0(getIpAddress, std::string());
     MOCK_CONST_METHOD0(getPort, int32_t());
@@ -45,7 +48,12 @@ public:
     MOCK_CONST_METHOD3(subscribeToService, void(const std::string&, int32_t, const std::shared_ptr<IServiceSubscriber>&));
     MOCK_CONST_METHOD1(unsubscribeFromService, void(const std::shared_ptr<IServiceSubscriber>&));
     MOCK_CONST_METHOD1(sendAction, xml::Document(const Action&));
+    MOCK_CONST_METHOD2(sendActionAsync, void(Action, const ActionResultCb&));
+    MOCK_METHOD1(setConnectionPool, void(const std::shared_ptr<HttpConnectionPool>&));
+    MOCK_METHOD2(setActionCoalescing, void(const std::set<std::string>&, std::chrono::milliseconds));
     MOCK_CONST_METHOD1(downloadXmlDocument, xml::Document(const std::string&));
+    MOCK_METHOD2(setDocumentCache, void(std::chrono::seconds, uint64_t));
+    MOCK_METHOD0(clearDocumentCache, void());
 };
 
 }
@@ -0,0 +1,245 @@
+//    Copyright (C) 2012 Dirk Vanden Boer <dirk.vdb@gmail.com>
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "httptestserver.h"
+
+#include "upnp/upnpaction.h"
+#include "upnp/upnpfactory.h"
+#include "upnp/upnpclientinterface.h"
+#include "upnp/upnphttpconnectionpool.h"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace upnp
+{
+namespace test
+{
+
+static std::string createVolumeResponse(const std::string& volume)
+{
+    std::string body =
+        "<?xml version=\"1.0\"?>"
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+        "<s:Body>"
+        "<u:GetVolumeResponse xmlns:u=\"urn:schemas-upnp-org:service:RenderingControl:1\">"
+        "<CurrentVolume>" + volume + "</CurrentVolume>"
+        "</u:GetVolumeResponse>"
+        "</s:Body>"
+        "</s:Envelope>";
+
+    return "HTTP/1.1 200 OK\r\nContent-Type: text/xml; charset=\"utf-8\"\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+static std::string createDocumentResponse(const std::string& value)
+{
+    std::string body = "<?xml version=\"1.0\"?><root><value>" + value + "</value></root>";
+    return "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+class ClientTest : public Test
+{
+protected:
+    ClientTest()
+    : client(factory::createClient())
+    {
+        // the actions are sent over the pool, the UPnP stack is not needed
+        client->setConnectionPool(std::make_shared<HttpConnectionPool>());
+    }
+
+    Action createGetVolume(const std::string& url, const std::string& channel)
+    {
+        Action action("GetVolume", url, ServiceType::RenderingControl);
+        action.addArgument("InstanceID", "0");
+        action.addArgument("Channel", channel);
+        return action;
+    }
+
+    // sends the actions at the same time, returns the received volumes
+    std::vector<std::string> sendConcurrently(const std::vector<Action>& actions)
+    {
+        std::vector<std::future<std::string>> futures;
+        for (auto& action : actions)
+        {
+            futures.push_back(std::async(std::launch::async, [this, &action] () {
+                return client->sendAction(action).getChildNodeValueRecursive("CurrentVolume");
+            }));
+        }
+
+        std::vector<std::string> volumes;
+        for (auto& future : futures)
+        {
+            volumes.push_back(future.get());
+        }
+
+        return volumes;
+    }
+
+    // sends the action asynchronously, returns the error code and the received volume
+    std::pair<int32_t, std::string> sendAsync(Action action)
+    {
+        auto result = std::make_shared<std::promise<std::pair<int32_t, std::string>>>();
+        auto future = result->get_future();
+
+        client->sendActionAsync(std::move(action), [result] (int32_t errorCode, xml::Document doc) {
+            result->set_value({ errorCode, doc ? doc.getChildNodeValueRecursive("CurrentVolume") : "" });
+        });
+
+        if (future.wait_for(5s) != std::future_status::ready)
+        {
+            throw std::runtime_error("The action callback was not called");
+        }
+
+        return future.get();
+    }
+
+    std::string downloadValue(const std::string& url)
+    {
+        return client->downloadXmlDocument(url).getChildNodeValueRecursive("value");
+    }
+
+    std::unique_ptr<IClient> client;
+};
+
+TEST_F(ClientTest, CoalesceIdenticalConcurrentActions)
+{
+    HttpTestServer server({ createVolumeResponse("25"), createVolumeResponse("25"), createVolumeResponse("25") }, 500ms);
+    client->setActionCoalescing({ "GetVolume" }, 0ms);
+
+    auto action = createGetVolume(server.getUrl(), "Master");
+    EXPECT_THAT(sendConcurrently({ action, action, action }), ElementsAre("25", "25", "25"));
+    EXPECT_EQ(1u, server.getRequestCount());
+}
+
+TEST_F(ClientTest, DontCoalesceActionsWithDifferentArguments)
+{
+    HttpTestServer server({ createVolumeResponse("25"), createVolumeResponse("30") }, 500ms);
+    client->setActionCoalescing({ "GetVolume" }, 0ms);
+
+    auto volumes = sendConcurrently({ createGetVolume(server.getUrl(), "Master"), createGetVolume(server.getUrl(), "LF") });
+    EXPECT_THAT(volumes, UnorderedElementsAre("25", "30"));
+    EXPECT_EQ(2u, server.getRequestCount());
+}
+
+TEST_F(ClientTest, DontCoalesceActionsThatAreNotListed)
+{
+    HttpTestServer server({ createVolumeResponse("25"), createVolumeResponse("25") }, 500ms);
+    client->setActionCoalescing({ "GetMute" }, 0ms);
+
+    auto action = createGetVolume(server.getUrl(), "Master");
+    EXPECT_THAT(sendConcurrently({ action, action }), ElementsAre("25", "25"));
+    EXPECT_EQ(2u, server.getRequestCount());
+}
+
+TEST_F(ClientTest, RejectResponseLargerThanMaxContentLength)
+{
+    HttpTestServer server({ createVolumeResponse("25"), createVolumeResponse("30") });
+    auto action = createGetVolume(server.getUrl(), "Master");
+
+    client->setMaxContentLength(100);
+    EXPECT_THROW(client->sendAction(action), Exception);
+
+    client->setMaxContentLength(1024);
+    EXPECT_EQ("30", client->sendAction(action).getChildNodeValueRecursive("CurrentVolume"));
+}
+
+TEST_F(ClientTest, ReuseActionResultDuringTimeToLive)
+{
+    HttpTestServer server({ createVolumeResponse("25"), createVolumeResponse("30") });
+    client->setActionCoalescing({ "GetVolume" }, 10s);
+
+    auto action = createGetVolume(server.getUrl(), "Master");
+    EXPECT_EQ("25", client->sendAction(action).getChildNodeValueRecursive("CurrentVolume"));
+    EXPECT_EQ("25", client->sendAction(action).getChildNodeValueRecursive("CurrentVolume"));
+    EXPECT_EQ(1u, server.getRequestCount());
+
+    // disabling the coalescing drops the cached results
+    client->setActionCoalescing({}, 0ms);
+    EXPECT_EQ("30", client->sendAction(action).getChildNodeValueRecursive("CurrentVolume"));
+    EXPECT_EQ(2u, server.getRequestCount());
+}
+
+TEST_F(ClientTest, SendActionAsync)
+{
+    // the asynchronous actions are sent by the UPnP stack
+    HttpTestServer server({ createVolumeResponse("25") });
+    client->initialize();
+
+    auto result = sendAsync(createGetVolume(server.getUrl(), "Master"));
+    EXPECT_EQ(UPNP_E_SUCCESS, result.first);
+    EXPECT_EQ("25", result.second);
+}
+
+TEST_F(ClientTest, SendActionAsyncReportsFailure)
+{
+    // the connection is closed without a response
+    HttpTestServer server({ "" });
+    client->initialize();
+
+    auto result = sendAsync(createGetVolume(server.getUrl(), "Master"));
+    EXPECT_NE(UPNP_E_SUCCESS, result.first);
+    EXPECT_TRUE(result.second.empty());
+}
+
+TEST_F(ClientTest, ReuseCachedDocumentDuringTimeToLive)
+{
+    HttpTestServer server({ createDocumentResponse("1"), createDocumentResponse("2") });
+    client->initialize();
+    client->setDocumentCache(10s, 0);
+
+    EXPECT_EQ("1", downloadValue(server.getUrl()));
+    EXPECT_EQ("1", downloadValue(server.getUrl()));
+    EXPECT_EQ(1u, server.getRequestCount());
+}
+
+TEST_F(ClientTest, DownloadDocumentAgainAfterExpiry)
+{
+    HttpTestServer server({ createDocumentResponse("1"), createDocumentResponse("2") });
+    client->initialize();
+    client->setDocumentCache(1s, 0);
+
+    EXPECT_EQ("1", downloadValue(server.getUrl()));
+    std::this_thread::sleep_for(1100ms);
+    EXPECT_EQ("2", downloadValue(server.getUrl()));
+    EXPECT_EQ(2u, server.getRequestCount());
+}
+
+TEST_F(ClientTest, EvictLeastRecentlyUsedDocument)
+{
+    HttpTestServer server({ createDocumentResponse("1"), createDocumentResponse("2"), createDocumentResponse("3") });
+    client->initialize();
+
+    // the cache only fits a single document, the responses have the same size
+    auto response = createDocumentResponse("1");
+    client->setDocumentCache(10s, response.size() - response.find("\r\n\r\n") - 4);
+
+    EXPECT_EQ("1", downloadValue(server.getUrl() + "?a"));
+    EXPECT_EQ("2", downloadValue(server.getUrl() + "?b"));
+    EXPECT_EQ("2", downloadValue(server.getUrl() + "?b"));
+    EXPECT_EQ("3", downloadValue(server.getUrl() + "?a"));
+    EXPECT_EQ(3u, server.getRequestCount());
+}
+
+}
+}
@@ -139,7 +139,7 @@ protected:
         event.ChangedVariables = doc;
         strcpy(event.Sid, g_subscriptionId);
 
-        client.UPnPEventOccurredEvent(&event);
+        callback->onServiceEvent(UPNP_EVENT_RECEIVED, &event);
     }
 
     std::string getIndexString(uint32_t index)
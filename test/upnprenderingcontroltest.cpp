@@ -125,7 +125,7 @@ protected:
         event.ChangedVariables = doc;
         strcpy(event.Sid, g_subscriptionId);
 
-        client.UPnPEventOccurredEvent(&event);
+        callback->onServiceEvent(UPNP_EVENT_RECEIVED, &event);
     }
 
     std::unique_ptr<RenderingControl::Client>   renderingControl;
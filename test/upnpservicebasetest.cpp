@@ -88,6 +88,11 @@ public:
     {
         return executeAction(actionType, args);
     }
+
+    void doExecuteActionAsync(ServiceImplAction actionType, const std::map<std::string, std::string>& args, const ActionResultCb& cb)
+    {
+        executeActionAsync(actionType, args, cb);
+    }
 };
 
 class ServiceBaseTest : public Test
@@ -162,7 +167,7 @@ protected:
         event.ChangedVariables = doc;
         strcpy(event.Sid, g_subscriptionId);
 
-        client.UPnPEventOccurredEvent(&event);
+        subscriptionCallback->onServiceEvent(UPNP_EVENT_RECEIVED, &event);
     }
 
     std::unique_ptr<ServiceImplMock>        service;
@@ -188,15 +193,29 @@ TEST_F(ServiceBaseTest, renewSubscription)
     strcpy(event.PublisherUrl, g_subscriptionUrl.c_str());
     strcpy(event.Sid, g_subscriptionId);
 
-    int32_t timeout = g_defaultTimeout;
     EXPECT_CALL(*service, getSubscriptionTimeout()).WillOnce(Return(g_defaultTimeout));
-    EXPECT_CALL(client, subscribeToService(g_subscriptionUrl, timeout)).WillOnce(Return(g_subscriptionId));
+    EXPECT_CALL(client, subscribeToService(g_subscriptionUrl, g_defaultTimeout, subscriptionCallback));
     subscriptionCallback->onServiceEvent(UPNP_EVENT_SUBSCRIPTION_EXPIRED, &event);
+    triggerSubscriptionComplete();
 
     EXPECT_CALL(client, unsubscribeFromService(subscriptionCallback));
     unsubscribe();
 }
 
+TEST_F(ServiceBaseTest, unsubscribeBeforeSubscriptionComplete)
+{
+    EXPECT_CALL(*service, getSubscriptionTimeout()).WillOnce(Return(g_defaultTimeout));
+    EXPECT_CALL(client, subscribeToService(g_subscriptionUrl, g_defaultTimeout, _))
+        .WillOnce(Invoke([&] (const std::string&, int32_t, const std::shared_ptr<IServiceSubscriber>& cb) { subscriptionCallback = cb; }));
+    service->subscribe();
+
+    EXPECT_CALL(client, unsubscribeFromService(subscriptionCallback));
+    service->unsubscribe();
+
+    // the completion of the pending subscription arrives after the unsubscribe
+    triggerSubscriptionComplete();
+}
+
 TEST_F(ServiceBaseTest, unsubscribeNotSubscribed)
 {
     EXPECT_CALL(client, unsubscribeFromService(subscriptionCallback)).Times(0);
@@ -218,6 +237,26 @@ TEST_F(ServiceBaseTest, executeAction)
     EXPECT_EQ(expectedDoc.toString(), doc.toString());
 }
 
+TEST_F(ServiceBaseTest, executeActionAsync)
+{
+    Action expectedAction("Action1", g_controlUrl, ServiceType::RenderingControl);
+    expectedAction.addArgument("Arg1", "1");
+
+    EXPECT_CALL(*service, actionToString(ServiceImplAction::Action1)).WillOnce(Return("Action1"));
+    EXPECT_CALL(client, sendActionAsync(expectedAction, _)).WillOnce(Invoke([] (Action, const ActionResultCb& cb) {
+        cb(UPNP_E_SUCCESS, xml::Document("<doc></doc>"));
+    }));
+
+    bool called = false;
+    service->doExecuteActionAsync(ServiceImplAction::Action1, { {"Arg1", "1"} }, [&] (int32_t errorCode, xml::Document doc) {
+        EXPECT_EQ(UPNP_E_SUCCESS, errorCode);
+        EXPECT_EQ(xml::Document("<doc></doc>").toString(), doc.toString());
+        called = true;
+    });
+
+    EXPECT_TRUE(called);
+}
+
 TEST_F(ServiceBaseTest, stateVariableEvent)
 {
     subscribe();
@@ -23,6 +23,10 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <future>
 
 #include "upnp/upnpclientinterface.h"
 #include "upnp/upnpwebserver.h"
@@ -50,6 +54,73 @@ public:
     MOCK_METHOD0(close, void());
 };
 
+class StringCallback : public IVirtualDirCallback
+{
+public:
+    StringCallback(const std::string& data)
+    : m_data(data)
+    , m_position(0)
+    {
+    }
+
+    uint64_t read(uint8_t* buf, uint64_t buflen) override
+    {
+        auto size = std::min<uint64_t>(buflen, m_data.size() - m_position);
+        memcpy(buf, m_data.data() + m_position, size);
+        m_position += size;
+        return size;
+    }
+
+    void seekAbsolute(uint64_t position) override   { m_position = position; }
+    void seekRelative(uint64_t offset) override     { m_position += offset; }
+    void seekFromEnd(uint64_t offset) override      { m_position = m_data.size() - offset; }
+    void close() override                           {}
+
+private:
+    std::string     m_data;
+    uint64_t        m_position;
+};
+
+// the first read blocks until the gate (if any) is opened, the test is notified when it is entered
+class GatedCallback : public StringCallback
+{
+public:
+    GatedCallback(const std::string& data, std::shared_future<void> gate)
+    : StringCallback(data)
+    , closeCount(0)
+    , m_gate(gate)
+    , m_entered(false)
+    {
+    }
+
+    uint64_t read(uint8_t* buf, uint64_t buflen) override
+    {
+        if (!m_entered)
+        {
+            m_entered = true;
+            entered.set_value();
+            if (m_gate.valid())
+            {
+                m_gate.wait_for(std::chrono::seconds(5));
+            }
+        }
+
+        return StringCallback::read(buf, buflen);
+    }
+
+    void close() override
+    {
+        ++closeCount;
+    }
+
+    std::promise<void>      entered;
+    std::atomic<uint32_t>   closeCount;
+
+private:
+    std::shared_future<void>    m_gate;
+    bool                        m_entered;
+};
+
 class WebServerTest : public Test
 {
 public:
@@ -126,6 +197,33 @@ TEST_F(WebServerTest, downloadBinaryFile)
     EXPECT_EQ(0, memcmp(file.data(), result.data(), file.size()));
 }
 
+TEST_F(WebServerTest, downloadFilesUsingConnectionPool)
+{
+    auto text = createTextFile();
+    auto binary = createBinaryFile();
+
+    webserver->addVirtualDirectory("virtualDir");
+    webserver->addFile("virtualDir", "testfile.txt", "text/plain", text);
+    webserver->addFile("virtualDir", "testfile.bin", "application/octet-stream", binary);
+
+    HttpClient pooledClient(5, std::make_shared<HttpConnectionPool>(1, std::chrono::seconds(5)));
+    std::string url = webserver->getWebRootUrl() + "virtualDir/";
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(text.size(), pooledClient.getContentLength(url + "testfile.txt"));
+        EXPECT_EQ(text, pooledClient.getText(url + "testfile.txt"));
+        EXPECT_EQ(binary, pooledClient.getData(url + "testfile.bin"));
+
+        auto result = pooledClient.getData(url + "testfile.bin", 4, 2);
+        EXPECT_EQ(2U, result.size());
+        EXPECT_EQ(5U, result[0]);
+        EXPECT_EQ(6U, result[1]);
+    }
+
+    EXPECT_THROW(pooledClient.getText(url + "missing.txt"), Exception);
+}
+
 TEST_F(WebServerTest, downloadPartialBinaryFile)
 {
     auto file = createBinaryFile();
@@ -149,6 +247,136 @@ TEST_F(WebServerTest, downloadPartialBinaryFile)
 }
 
 
+TEST_F(WebServerTest, modifyFilesWhileDownloading)
+{
+    auto file = std::make_shared<std::vector<uint8_t>>(createBinaryFile());
+
+    webserver->addVirtualDirectory("virtualDir");
+    webserver->addFile("virtualDir", "testfile.bin", "application/octet-stream", file);
+
+    // the downloads are served from a registry snapshot while the files are replaced, added and removed
+    std::atomic<bool> stop(false);
+    auto modifier = std::async(std::launch::async, [&] () {
+        for (uint32_t i = 0; !stop; ++i)
+        {
+            auto filename = fmt::format("other{}.bin", i % 10);
+            webserver->addFile("virtualDir", "testfile.bin", "application/octet-stream", file);
+            webserver->addFile("virtualDir", filename, "application/octet-stream", file);
+            webserver->removeFile("virtualDir", filename);
+        }
+    });
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/testfile.bin";
+    uint32_t completeDownloads = 0;
+    try
+    {
+        for (int i = 0; i < 20; ++i)
+        {
+            if (httpClient.getData(url) == *file)
+            {
+                ++completeDownloads;
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        ADD_FAILURE() << e.what();
+    }
+
+    // stopped before checking the result, the modifications must not outlive the test
+    stop = true;
+    modifier.get();
+
+    EXPECT_EQ(20u, completeDownloads);
+}
+
+TEST_F(WebServerTest, downloadSharedBinaryFile)
+{
+    auto file = std::make_shared<std::vector<uint8_t>>(createBinaryFile());
+
+    webserver->addVirtualDirectory("virtualDir");
+    webserver->addFile("virtualDir", "testfile.bin", "application/octet-stream", file);
+    webserver->addFile("virtualDir", "alias.bin", "application/octet-stream", file);
+
+    for (auto& filename : { "testfile.bin", "alias.bin" })
+    {
+        std::string url = webserver->getWebRootUrl() + "virtualDir/" + filename;
+        auto result = httpClient.getData(url);
+
+        EXPECT_EQ(file->size(), httpClient.getContentLength(url));
+        EXPECT_EQ(0, memcmp(file->data(), result.data(), file->size()));
+    }
+
+    webserver->removeFile("virtualDir", "testfile.bin");
+    webserver->removeFile("virtualDir", "alias.bin");
+
+    // the webserver should no longer hold a reference to the buffer
+    EXPECT_TRUE(file.unique());
+}
+
+TEST_F(WebServerTest, addSharedFileWithoutData)
+{
+    webserver->addVirtualDirectory("virtualDir");
+    EXPECT_THROW(webserver->addFile("virtualDir", "testfile.bin", "application/octet-stream", std::shared_ptr<const std::vector<uint8_t>>()), Exception);
+    EXPECT_THROW(webserver->addFile("virtualDir", "testfile.bin", "application/octet-stream", std::shared_ptr<const uint8_t>(), 10), Exception);
+
+    // an empty file does not need data
+    EXPECT_NO_THROW(webserver->addFile("virtualDir", "empty.bin", "application/octet-stream", std::shared_ptr<const uint8_t>(), 0));
+}
+
+TEST_F(WebServerTest, evictLeastRecentlyUsedFiles)
+{
+    auto file = createBinaryFile();
+
+    webserver->addVirtualDirectory("virtualDir");
+    webserver->setMemoryBudget(file.size() * 2);
+    webserver->addFile("virtualDir", "pinned.bin", "application/octet-stream", file);
+    webserver->pinFile("virtualDir", "pinned.bin");
+    webserver->addFile("virtualDir", "first.bin", "application/octet-stream", file);
+    EXPECT_EQ(file.size() * 2, webserver->getMemoryUsage());
+
+    // the oldest file that is not pinned is evicted
+    webserver->addFile("virtualDir", "second.bin", "application/octet-stream", file);
+    EXPECT_EQ(file.size() * 2, webserver->getMemoryUsage());
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/";
+    EXPECT_EQ(file.size(), httpClient.getContentLength(url + "pinned.bin"));
+    EXPECT_EQ(file.size(), httpClient.getContentLength(url + "second.bin"));
+    EXPECT_THROW(httpClient.getContentLength(url + "first.bin"), Exception);
+
+    webserver->setFileTimeToLive("virtualDir", "second.bin", std::chrono::seconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    EXPECT_THROW(httpClient.getContentLength(url + "second.bin"), Exception);
+
+    webserver->purgeExpiredFiles();
+    EXPECT_EQ(file.size(), webserver->getMemoryUsage());
+}
+
+TEST_F(WebServerTest, downloadFileFromFileSystemDir)
+{
+    auto file = createBinaryFile();
+    {
+        std::ofstream fileStream("webservertest.bin", std::ios::binary);
+        fileStream.write(reinterpret_cast<const char*>(file.data()), file.size());
+    }
+
+    webserver->addVirtualDirectory("virtualDir", ".");
+    std::string url = webserver->getWebRootUrl() + "virtualDir/webservertest.bin";
+
+    EXPECT_EQ(file.size(), httpClient.getContentLength(url));
+    auto result = httpClient.getData(url);
+    EXPECT_EQ(0, memcmp(file.data(), result.data(), file.size()));
+
+    result = httpClient.getData(url, 4, 2);
+    EXPECT_EQ(2U, result.size());
+    EXPECT_EQ(5U, result[0]);
+    EXPECT_EQ(6U, result[1]);
+
+    EXPECT_THROW(httpClient.getContentLength(webserver->getWebRootUrl() + "virtualDir/missing.bin"), Exception);
+
+    std::remove("webservertest.bin");
+}
+
 TEST_F(WebServerTest, downloadTextFileThroughCalllback)
 {
     auto cb = std::make_shared<StrictMock<VirtualDirCallback>>();
@@ -185,6 +413,197 @@ TEST_F(WebServerTest, downloadTextFileThroughCalllback)
     EXPECT_TRUE(cb.unique());
 }
 
+TEST_F(WebServerTest, cacheFileInfoOfCallbackDir)
+{
+    auto file = createTextFile();
+    uint32_t infoRequests = 0;
+
+    VirtualFileInfo info;
+    info.modifyTime = 200;
+    info.sizeInBytes = file.size();
+    info.contentType = "text/plain";
+
+    webserver->addVirtualDirectory("virtualDir",
+                                   [&] (const std::string&) { ++infoRequests; return info; },
+                                   [&] (const std::string&) { return std::make_shared<StringCallback>(file); });
+    webserver->setFileInfoCaching("virtualDir", true);
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/testfile.txt";
+    EXPECT_EQ(file.size(), httpClient.getContentLength(url));
+    EXPECT_EQ(file, httpClient.getText(url));
+    EXPECT_EQ(1U, infoRequests);
+
+    info.sizeInBytes = 10;
+    webserver->invalidateFileInfo("virtualDir", "testfile.txt");
+    EXPECT_EQ(10U, httpClient.getContentLength(url));
+    EXPECT_EQ(2U, infoRequests);
+}
+
+TEST_F(WebServerTest, downloadTextFileThroughReadAheadCalllback)
+{
+    auto file = createTextFile();
+
+    fileops::FileSystemEntryInfo info;
+    info.modifyTime = 200;
+    info.sizeInBytes = file.size();
+    info.type = fileops::FileSystemEntryType::File;
+
+    ReadAheadSettings readAhead;
+    readAhead.blockSize = 1000;
+    readAhead.windowSize = 4096;
+
+    webserver->addVirtualDirectory("virtualDir",
+                                   [&] (const std::string&) { return info; },
+                                   [&] (const std::string&) { return std::make_shared<StringCallback>(file); },
+                                   readAhead);
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/?id=@100";
+    EXPECT_EQ(file, httpClient.getText(url));
+
+    auto result = httpClient.getData(url, 5000, 10);
+    EXPECT_EQ(file.substr(5000, 10), std::string(result.begin(), result.end()));
+}
+
+TEST_F(WebServerTest, downloadStreamOfUnknownSize)
+{
+    auto file = createTextFile();
+
+    VirtualFileInfo info;
+    info.unknownSize = true;
+    info.contentType = "audio/mpeg";
+
+    ReadAheadSettings readAhead;
+    readAhead.blockSize = 1000;
+    readAhead.windowSize = 4096;
+
+    webserver->addVirtualDirectory("virtualDir",
+                                   [&] (const std::string&) { return info; },
+                                   [&] (const std::string&) { return std::make_shared<StringCallback>(file); },
+                                   readAhead);
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/live.mp3";
+    EXPECT_EQ(file, httpClient.getText(url));
+}
+
+TEST_F(WebServerTest, timeSeekThroughCallback)
+{
+    class TimeSeekCallback : public StringCallback
+    {
+    public:
+        using StringCallback::StringCallback;
+
+        bool seekToTime(std::chrono::milliseconds start, std::chrono::milliseconds end) override
+        {
+            EXPECT_EQ(std::chrono::milliseconds(90500), start);
+            EXPECT_EQ(std::chrono::milliseconds(0), end);
+            seekAbsolute(100);
+            return true;
+        }
+    };
+
+    auto file = createTextFile();
+
+    VirtualFileInfo info;
+    info.sizeInBytes = file.size();
+
+    webserver->addVirtualDirectory("virtualDir",
+                                   [&] (const std::string&) { return info; },
+                                   [&] (const std::string&) { return std::make_shared<TimeSeekCallback>(file); });
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/track.mp3?npt=90.5-";
+    EXPECT_EQ(file.substr(100), httpClient.getText(url));
+}
+
+TEST_F(WebServerTest, readHandlesConcurrently)
+{
+    auto file = createTextFile();
+
+    VirtualFileInfo info;
+    info.sizeInBytes = file.size();
+
+    std::promise<void> gate;
+    auto gateFuture = gate.get_future().share();
+    std::vector<std::shared_ptr<GatedCallback>> callbacks = {
+        std::make_shared<GatedCallback>(file, gateFuture),
+        std::make_shared<GatedCallback>(file, gateFuture)
+    };
+
+    std::atomic<uint32_t> requestCount(0);
+    webserver->addVirtualDirectory("virtualDir",
+                                   [&] (const std::string&) { return info; },
+                                   [&] (const std::string&) { return callbacks.at(requestCount++); });
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/testfile.txt";
+    auto download1 = std::async(std::launch::async, [&] () { return HttpClient(5).getText(url); });
+    auto download2 = std::async(std::launch::async, [&] () { return HttpClient(5).getText(url); });
+
+    // a read that blocks in its provider does not block the read of another handle
+    EXPECT_EQ(std::future_status::ready, callbacks[0]->entered.get_future().wait_for(std::chrono::seconds(3)));
+    EXPECT_EQ(std::future_status::ready, callbacks[1]->entered.get_future().wait_for(std::chrono::seconds(3)));
+    gate.set_value();
+
+    EXPECT_EQ(file, download1.get());
+    EXPECT_EQ(file, download2.get());
+}
+
+TEST_F(WebServerTest, rejectStaleHandleAfterSlotReuse)
+{
+    auto file = createTextFile();
+
+    VirtualFileInfo info;
+    info.sizeInBytes = file.size();
+
+    std::promise<void> gate;
+    auto staleCallback = std::make_shared<GatedCallback>(file, gate.get_future().share());
+    auto callback = std::make_shared<GatedCallback>(file, std::shared_future<void>());
+
+    auto addDirectory = [&] (std::shared_ptr<GatedCallback> cb) {
+        webserver->addVirtualDirectory("virtualDir",
+                                       [&] (const std::string&) { return info; },
+                                       [cb] (const std::string&) { return cb; });
+    };
+
+    addDirectory(staleCallback);
+
+    std::string url = webserver->getWebRootUrl() + "virtualDir/testfile.txt";
+    auto staleDownload = std::async(std::launch::async, [&] () {
+        try { HttpClient(5).getText(url); } catch (std::exception&) {}
+    });
+
+    ASSERT_EQ(std::future_status::ready, staleCallback->entered.get_future().wait_for(std::chrono::seconds(5)));
+
+    // clearing the files closes the open handle, its slot is reused by the next download
+    auto clear = std::async(std::launch::async, [&] () { webserver->clearFiles(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    gate.set_value();
+    clear.get();
+    EXPECT_EQ(1u, staleCallback->closeCount);
+
+    addDirectory(callback);
+    EXPECT_EQ(file, httpClient.getText(url));
+    staleDownload.get();
+
+    // the reads and the close of the stale handle did not reach the new stream
+    EXPECT_EQ(1u, staleCallback->closeCount);
+    EXPECT_EQ(1u, callback->closeCount);
+}
+
+TEST(TimeSeekRangeTest, parse)
+{
+    auto range = parseTimeSeekRange("npt=10-20.5");
+    EXPECT_EQ(std::chrono::milliseconds(10000), range.start);
+    EXPECT_EQ(std::chrono::milliseconds(20500), range.end);
+
+    range = parseTimeSeekRange("1:02:03.250-");
+    EXPECT_EQ(std::chrono::milliseconds(3723250), range.start);
+    EXPECT_EQ(std::chrono::milliseconds(0), range.end);
+
+    EXPECT_THROW(parseTimeSeekRange("npt=-20"), Exception);
+    EXPECT_THROW(parseTimeSeekRange("npt=20-10"), Exception);
+    EXPECT_THROW(parseTimeSeekRange("npt=abc-"), Exception);
+    EXPECT_THROW(parseTimeSeekRange("npt=1:2-"), Exception);
+}
+
 TEST_F(WebServerTest, downloadBinaryFileThroughCalllback)
 {
 //    auto file = createBinaryFile();